@@ -36,6 +36,9 @@ public:
     // Does not block.
     optional<T> TryGet();
 
+    // Does not block.
+    bool Empty();
+
     void Clear();
 };
 
@@ -86,6 +89,13 @@ optional<T> Channel<T>::TryGet() {
     return result;
 }
 
+// Does not block.
+template<typename T>
+bool Channel<T>::Empty() {
+    unique_lock<mutex> lock(m);
+    return queue.empty();
+}
+
 template<typename T>
 void Channel<T>::Clear() {
     while (this->TryGet()) {}
@@ -0,0 +1,148 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/contenthash.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HASH_SSE2
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "src/string.h"
+
+using std::nullopt;
+using std::optional;
+using std::string;
+using std::unique_ptr;
+
+#define HASH_STRIPE_LEN 64
+#define HASH_LANES 8
+// The lanes are scrambled after this many stripes, so that no input bits get lost to the multiplications.
+#define HASH_STRIPES_PER_BLOCK 16
+// Read at a time. A whole number of blocks, so that only the last read can end mid block.
+#define HASH_READ_SIZE (1024 * 1024)
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+static const uint64_t HASH_SECRET[HASH_LANES] = {
+        0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+        0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+static const uint64_t HASH_SCRAMBLE_SECRET[HASH_LANES] = {
+        0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+        0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+};
+
+// Each lane gets the input of the lane next to it added, and the product of the two halves of its own input mixed
+// with the secret. Compilers don't manage to vectorize this by themselves, so it is spelled out for SSE2, which every
+// x86-64 CPU has.
+static void accumulate(uint64_t acc[HASH_LANES], const unsigned char *p, size_t stripes) {
+#ifdef HASH_SSE2
+    __m128i a[HASH_LANES / 2];
+    __m128i secret[HASH_LANES / 2];
+    for (int i = 0 ; i < HASH_LANES / 2 ; ++i) {
+        a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc) + i);
+        secret[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(HASH_SECRET) + i);
+    }
+    for (size_t s = 0 ; s < stripes ; ++s, p += HASH_STRIPE_LEN) {
+        for (int i = 0 ; i < HASH_LANES / 2 ; ++i) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p) + i);
+            __m128i keyed = _mm_xor_si128(in, secret[i]);
+            __m128i keyed_hi = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+            __m128i in_swapped = _mm_shuffle_epi32(in, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(in_swapped, _mm_mul_epu32(keyed, keyed_hi)));
+        }
+    }
+    for (int i = 0 ; i < HASH_LANES / 2 ; ++i) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc) + i, a[i]);
+    }
+#else
+    for (size_t s = 0 ; s < stripes ; ++s, p += HASH_STRIPE_LEN) {
+        uint64_t in[HASH_LANES];
+        memcpy(in, p, HASH_STRIPE_LEN);
+        for (int i = 0 ; i < HASH_LANES ; ++i) {
+            uint64_t keyed = in[i] ^ HASH_SECRET[i];
+            acc[i] += in[i ^ 1] + (keyed & 0xffffffff) * (keyed >> 32);
+        }
+    }
+#endif
+}
+
+static void scramble(uint64_t acc[HASH_LANES]) {
+    for (int i = 0 ; i < HASH_LANES ; ++i) {
+        acc[i] = ((acc[i] ^ (acc[i] >> 47)) ^ HASH_SCRAMBLE_SECRET[i]) * PRIME32_1;
+    }
+}
+
+// Accumulates whole blocks, leaving the lanes scrambled after each.
+static void accumulateBlocks(uint64_t acc[HASH_LANES], const unsigned char *p, size_t blocks) {
+    for (size_t b = 0 ; b < blocks ; ++b, p += HASH_STRIPE_LEN * HASH_STRIPES_PER_BLOCK) {
+        accumulate(acc, p, HASH_STRIPES_PER_BLOCK);
+        scramble(acc);
+    }
+}
+
+static uint64_t finish(const uint64_t acc[HASH_LANES], uint64_t len) {
+    uint64_t h = len * PRIME64_1;
+    for (int i = 0 ; i < HASH_LANES ; ++i) {
+        h ^= acc[i];
+        h *= PRIME64_2;
+        h = (h << 31) | (h >> 33);
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+optional<uint64_t> hashFile(const string &local_path) {
+#ifdef __WXMSW__
+    FILE *f = _wfopen(localPathUnicode(local_path).c_str(), L"rb");
+#else
+    FILE *f = fopen(local_path.c_str(), "rb");
+#endif
+    if (!f) {
+        return nullopt;
+    }
+
+    uint64_t acc[HASH_LANES] = {PRIME64_1, PRIME64_2, PRIME64_3, PRIME32_1, PRIME64_3, PRIME64_2, PRIME64_1, 0};
+    unique_ptr<unsigned char[]> buf(new unsigned char[HASH_READ_SIZE]);
+    uint64_t len = 0;
+    size_t n;
+    while ((n = fread(buf.get(), 1, HASH_READ_SIZE, f)) > 0) {
+        len += n;
+        size_t block_len = HASH_STRIPE_LEN * HASH_STRIPES_PER_BLOCK;
+        accumulateBlocks(acc, buf.get(), n / block_len);
+        if (n % block_len == 0) {
+            continue;
+        }
+
+        // The end of the file. The last stripe is padded with zeros, which the length mixed in at the end tells
+        // apart from real zeros.
+        const unsigned char *rest = buf.get() + n - n % block_len;
+        size_t rest_len = n % block_len;
+        accumulate(acc, rest, rest_len / HASH_STRIPE_LEN);
+        if (rest_len % HASH_STRIPE_LEN) {
+            unsigned char last[HASH_STRIPE_LEN] = {};
+            memcpy(last, rest + rest_len - rest_len % HASH_STRIPE_LEN, rest_len % HASH_STRIPE_LEN);
+            accumulate(acc, last, 1);
+        }
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        return nullopt;
+    }
+    return finish(acc, len);
+}
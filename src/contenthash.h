@@ -0,0 +1,17 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_CONTENTHASH_H_
+#define SRC_CONTENTHASH_H_
+
+#include <optional>
+#include <string>
+
+using std::optional;
+using std::string;
+
+// A fast non-cryptographic hash of a local file's content, to tell whether a save changed anything at all. Built like
+// XXH3, with eight independent lanes per 64 byte stripe, accumulated two at a time with SSE2 intrinsics where available
+// and one at a time otherwise, to the same hash. Returns nullopt if the file can't be read.
+optional<uint64_t> hashFile(const string &local_path);
+
+#endif  // SRC_CONTENTHASH_H_
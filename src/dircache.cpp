@@ -0,0 +1,125 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/dircache.h"
+
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/paths.h"
+
+using std::make_shared;
+using std::move;
+using std::next;
+using std::optional;
+using std::string;
+
+DirCache::DirCache(size_t max_entries) : max_entries_(max_entries) {}
+
+DirListingSnapshot DirCache::Get(string path) {
+    auto it = this->dirs_.find(path);
+    if (it == this->dirs_.end()) {
+        return nullptr;
+    }
+
+    this->lru_.splice(this->lru_.begin(), this->lru_, it->second.lru_pos);
+    return it->second.entries;
+}
+
+bool DirCache::IsFresh(string path, steady_clock::duration max_age) {
+    auto it = this->dirs_.find(path);
+    return it != this->dirs_.end() && steady_clock::now() - it->second.fetched < max_age;
+}
+
+void DirCache::Put(string path, DirListingSnapshot entries) {
+    auto it = this->dirs_.find(path);
+    if (it != this->dirs_.end()) {
+        this->Erase(it);
+    }
+
+    this->lru_.push_front(path);
+    this->num_entries_ += entries->Count();
+    this->dirs_[path] = CachedDir{move(entries), steady_clock::now(), this->lru_.begin()};
+    this->Evict();
+}
+
+void DirCache::Patch(string path, optional<DirEntry> entry) {
+    path = normalize_path(path);
+
+    if (!entry.has_value()) {
+        // Listings of the path itself, or anything below it, are gone.
+        string prefix = path == "/" ? "/" : path + "/";
+        for (auto it = this->dirs_.begin() ; it != this->dirs_.end() ;) {
+            auto following = next(it);
+            if (it->first == path || it->first.compare(0, prefix.size(), prefix) == 0) {
+                this->Erase(it);
+            }
+            it = following;
+        }
+    }
+
+    auto it = this->dirs_.find(normalize_path(path + "/.."));
+    if (it == this->dirs_.end() || path == "/") {
+        return;
+    }
+
+    auto entries = make_shared<DirListing>(*it->second.entries);
+    string name = basename(path);
+    for (size_t i = 0 ; i < entries->Count() ; ++i) {
+        if (entries->Name(i) == name) {
+            entries->Remove(i);
+            this->num_entries_--;
+            break;
+        }
+    }
+
+    if (entry.has_value()) {
+        // Entries from a stat don't come with user and group names, but a sibling with the same ids usually has them.
+        for (size_t i = 0 ; i < entries->Count() ; ++i) {
+            if (entry->owner_.empty() && entries->Uid(i) == entry->uid_) {
+                entry->owner_ = string(entries->Owner(i));
+            }
+            if (entry->group_.empty() && entries->Gid(i) == entry->gid_) {
+                entry->group_ = string(entries->Group(i));
+            }
+        }
+
+        entry->name_ = name;
+        entries->Add(*entry);
+        this->num_entries_++;
+    }
+
+    it->second.entries = entries;
+    this->Evict();
+}
+
+void DirCache::Clear() {
+    this->dirs_.clear();
+    this->lru_.clear();
+    this->num_entries_ = 0;
+}
+
+void DirCache::ForEach(function<void(const string &path, const DirListing &entries,
+                                     steady_clock::time_point fetched)> cb) const {
+    for (auto &path : this->lru_) {
+        auto &dir = this->dirs_.at(path);
+        cb(path, *dir.entries, dir.fetched);
+    }
+}
+
+void DirCache::Erase(unordered_map<string, CachedDir>::iterator it) {
+    this->num_entries_ -= it->second.entries->Count();
+    this->lru_.erase(it->second.lru_pos);
+    this->dirs_.erase(it);
+}
+
+void DirCache::Evict() {
+    // Always keep the most recently used listing, even if it alone is above the limit.
+    while (this->num_entries_ > this->max_entries_ && this->lru_.size() > 1) {
+        this->Erase(this->dirs_.find(this->lru_.back()));
+    }
+}
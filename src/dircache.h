@@ -0,0 +1,66 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_DIRCACHE_H_
+#define SRC_DIRCACHE_H_
+
+#include <chrono>  // NOLINT
+#include <functional>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "src/direntry.h"
+#include "src/dirlisting.h"
+
+using std::function;
+using std::list;
+using std::optional;
+using std::string;
+using std::unordered_map;
+using std::chrono::steady_clock;
+
+// Recently seen directory listings, so that a directory can be shown right away while it is listed again. The least
+// recently used listings are evicted when the total number of entries goes above a limit.
+class DirCache {
+private:
+    struct CachedDir {
+        DirListingSnapshot entries;
+        steady_clock::time_point fetched;
+        list<string>::iterator lru_pos;
+    };
+
+    size_t max_entries_;
+    size_t num_entries_ = 0;
+    list<string> lru_;  // Most recently used first.
+    unordered_map<string, CachedDir> dirs_;
+
+public:
+    explicit DirCache(size_t max_entries);
+
+    // Returns nullptr if path is not cached.
+    DirListingSnapshot Get(string path);
+
+    // True if the listing of path was fetched less than max_age ago.
+    bool IsFresh(string path, steady_clock::duration max_age);
+
+    void Put(string path, DirListingSnapshot entries);
+
+    // Updates the cached listing of the parent dir of path after we changed path ourselves. The entry for path is
+    // replaced by entry, or removed if entry is empty, in which case any cached listings under path are dropped too.
+    // The parent's listing is replaced by an updated copy, as others may be holding on to it.
+    void Patch(string path, optional<DirEntry> entry);
+
+    void Clear();
+
+    // Calls cb for each cached listing, the most recently used first.
+    void ForEach(function<void(const string &path, const DirListing &entries,
+                               steady_clock::time_point fetched)> cb) const;
+
+private:
+    void Erase(unordered_map<string, CachedDir>::iterator it);
+
+    void Evict();
+};
+
+#endif  // SRC_DIRCACHE_H_
@@ -21,8 +21,13 @@ DirEntry::DirEntry(LIBSSH2_SFTP_ATTRIBUTES attrs) {
     }
     if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
         this->mode_ = attrs.permissions;
+        this->mode_str_ = modeString(attrs.permissions);
         this->is_dir_ = LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
     }
+    if (attrs.flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+        this->uid_ = attrs.uid;
+        this->gid_ = attrs.gid;
+    }
 }
 
 string DirEntry::SizeFormatted(bool as_bytes) {
@@ -44,3 +49,68 @@ string DirEntry::ModifiedFormatted() {
     t.MakeUTC();
     return t.FormatISOCombined(' ').ToStdString(wxMBConvUTF8());
 }
+
+bool DirEntry::operator==(const DirEntry &other) const {
+    return this->name_ == other.name_
+           && this->size_ == other.size_
+           && this->modified_ == other.modified_
+           && this->mode_ == other.mode_
+           && this->mode_str_ == other.mode_str_
+           && this->uid_ == other.uid_
+           && this->gid_ == other.gid_
+           && this->owner_ == other.owner_
+           && this->group_ == other.group_
+           && this->is_dir_ == other.is_dir_;
+}
+
+bool DirEntry::operator!=(const DirEntry &other) const {
+    return !(*this == other);
+}
+
+bool DirEntry::SameVersion(const DirEntry &other) const {
+    return this->size_ == other.size_ && this->modified_ == other.modified_;
+}
+
+string modeString(uint64_t mode) {
+    string s = "----------";
+    switch (mode & LIBSSH2_SFTP_S_IFMT) {
+        case LIBSSH2_SFTP_S_IFDIR:
+            s[0] = 'd';
+            break;
+        case LIBSSH2_SFTP_S_IFLNK:
+            s[0] = 'l';
+            break;
+        case LIBSSH2_SFTP_S_IFCHR:
+            s[0] = 'c';
+            break;
+        case LIBSSH2_SFTP_S_IFBLK:
+            s[0] = 'b';
+            break;
+        case LIBSSH2_SFTP_S_IFIFO:
+            s[0] = 'p';
+            break;
+        case LIBSSH2_SFTP_S_IFSOCK:
+            s[0] = 's';
+            break;
+    }
+
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0 ; i < 9 ; ++i) {
+        if (mode & (0400 >> i)) {
+            s[i + 1] = rwx[i];
+        }
+    }
+
+    // Setuid, setgid and sticky bits show in place of the corresponding execute bit.
+    if (mode & 04000) {
+        s[3] = s[3] == 'x' ? 's' : 'S';
+    }
+    if (mode & 02000) {
+        s[6] = s[6] == 'x' ? 's' : 'S';
+    }
+    if (mode & 01000) {
+        s[9] = s[9] == 'x' ? 't' : 'T';
+    }
+
+    return s;
+}
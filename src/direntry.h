@@ -14,11 +14,13 @@ public:
     string name_;
     uint64_t size_ = 0;
     uint64_t modified_ = 0;
-    uint64_t mode_;
+    uint64_t mode_ = 0;
     string mode_str_;
+    uint64_t uid_ = 0;
+    uint64_t gid_ = 0;
     string owner_;
     string group_;
-    bool is_dir_;
+    bool is_dir_ = false;  // Also for symlinks to dirs, when known.
 
     DirEntry() {}
 
@@ -27,6 +29,16 @@ public:
     string SizeFormatted(bool as_bytes);
 
     string ModifiedFormatted();
+
+    bool operator==(const DirEntry &other) const;
+
+    bool operator!=(const DirEntry &other) const;
+
+    // True if both are likely the same version of a file's content, going by size and modified time.
+    bool SameVersion(const DirEntry &other) const;
 };
 
+// Formats permission bits the way "ls -l" does, for example "drwxr-xr-x".
+string modeString(uint64_t mode);
+
 #endif  // SRC_DIRENTRY_H_
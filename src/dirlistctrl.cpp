@@ -12,22 +12,42 @@
 #include <wx/listctrl.h>
 #include <wx/wx.h>
 
+#include <algorithm>
 #include <future>  // NOLINT
-#include <regex>  // NOLINT
 #include <vector>
 
 #include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/filetypes.h"
 
 using std::function;
-using std::regex;
+using std::min;
+using std::sort;
 using std::vector;
 
 
 typedef function<void(void)> OnItemActivatedCb;
 typedef function<void(int)> OnColumnHeaderClickCb;
 
+// Formatted rows are dropped once there are this many, which is plenty for what fits on a screen.
+#define MAX_FORMATTED_ROWS 2000
+// How long rows that changed in an Update stay lit up.
+#define FLASH_MS 1500
 
-int DirListCtrl::IconIdx(DirEntry entry) {
+static wxColour flashColour() {
+    return wxSystemSettings::GetColour(wxSYS_COLOUR_INFOBK);
+}
+
+DirListCtrl::DirListCtrl(wxImageList *icons_image_list) : icons_image_list_(icons_image_list) {
+    this->flash_timer_.Bind(wxEVT_TIMER, [&](wxTimerEvent &event) {
+        vector<long> rows(this->flashed_rows_.begin(), this->flashed_rows_.end());
+        this->flashed_rows_.clear();
+        this->RedrawRows(rows);
+    });
+}
+
+
+int DirListCtrl::IconIdx(const DirEntry &entry) {
     // These numbers correspond to the order the icons in icons_image_list_ were added...
     int r = 0;
     if (entry.is_dir_) {
@@ -37,39 +57,139 @@ int DirListCtrl::IconIdx(DirEntry entry) {
     } else if (entry.mode_ & LIBSSH2_SFTP_S_IXUSR || entry.mode_ & LIBSSH2_SFTP_S_IXGRP
                || entry.mode_ & LIBSSH2_SFTP_S_IXOTH) {
         r = 2;
-    } else if (regex_search(entry.name_, regex(
-            "(\\.jpeg|\\.jpg|\\.png|\\.gif|\\.webp|\\.bmp|\\.psd|\\.ai|\\.svg|\\.psd|\\.eps|\\.tif|\\.tiff)$"))) {
-        r = 4;
-    } else if (regex_search(entry.name_, regex("(\\.tar|\\.tgz|\\.gz|\\.bz2|\\.7z|\\.xz|\\.zip)$"))) {
-        r = 5;
+    } else {
+        switch (this->file_types_.Of(entry.name_)) {
+            case FILE_TYPE_PICTURE:
+                r = 4;
+                break;
+            case FILE_TYPE_ARCHIVE:
+                r = 5;
+                break;
+            default:
+                break;
+        }
     }
     return r;
 }
 
-DvlcDirList::DvlcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *icons_image_list) : DirListCtrl(
-        icons_image_list) {
-    this->dvlc_ = new wxDataViewListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize,
-                                         wxDV_ROW_LINES);
-    this->config_ = config;
+void DirListCtrl::SetEntries(const DirListingView &entries) {
+    this->entries_ = entries;
+    this->rows_.clear();
+    this->flashed_rows_.clear();
+    this->size_as_bytes_ = this->config_->Read("/size_units", "1") == "2";
+    this->file_types_.Clear();
+    this->file_types_.Add(this->config_->Read("/picture_types", "").ToStdString(wxMBConvUTF8()), FILE_TYPE_PICTURE);
+    this->file_types_.Add(this->config_->Read("/archive_types", "").ToStdString(wxMBConvUTF8()), FILE_TYPE_ARCHIVE);
+}
 
-    // TODO(allan): wxDATAVIEW_CELL_EDITABLE for renaming files?
-    auto col = this->dvlc_->AppendIconTextColumn("  Name", wxDATAVIEW_CELL_INERT);
-    col->SetWidth(300);
+void DirListCtrl::Update(const DirListingView &entries, const DirListingDiff &diff) {
+    int highlighted = this->GetHighlighted();
+    vector<int> selected;
+    for (auto i : this->GetSelected()) {
+        if (i < diff.moved_to.size() && diff.moved_to[i] >= 0) {
+            selected.push_back(diff.moved_to[i]);
+        }
+    }
+    if (highlighted < diff.moved_to.size() && diff.moved_to[highlighted] >= 0) {
+        highlighted = diff.moved_to[highlighted];
+    } else {
+        // The highlighted entry is gone, so stay on the row that took its place.
+        highlighted = min(highlighted, static_cast<int>(entries.Count()) - 1);
+    }
+
+    this->Patch(entries, diff);
+    this->SetSelected(selected);
+    this->SetHighlighted(highlighted);
+
+    vector<long> flashed(diff.inserted.begin(), diff.inserted.end());
+    flashed.insert(flashed.end(), diff.updated.begin(), diff.updated.end());
+    if (!flashed.empty()) {
+        this->flashed_rows_.insert(flashed.begin(), flashed.end());
+        this->RedrawRows(flashed);
+        this->flash_timer_.StartOnce(FLASH_MS);
+    }
+}
+
+bool DirListCtrl::IsFlashed(long row) const {
+    return this->flashed_rows_.find(row) != this->flashed_rows_.end();
+}
+
+const DirListRow &DirListCtrl::Row(long row) {
+    auto it = this->rows_.find(row);
+    if (it != this->rows_.end()) {
+        return it->second;
+    }
+
+    if (this->rows_.size() >= MAX_FORMATTED_ROWS) {
+        this->rows_.clear();
+    }
+
+    auto entry = this->entries_.Get(row);
+    auto &r = this->rows_[row];
+    r.cells[0] = wxString::FromUTF8(entry.name_);
+    r.cells[1] = entry.SizeFormatted(this->size_as_bytes_);
+    r.cells[2] = entry.ModifiedFormatted();
+    r.cells[3] = entry.mode_str_;
+    r.cells[4] = wxString::FromUTF8(entry.owner_);
+    r.cells[5] = wxString::FromUTF8(entry.group_);
+    r.icon = this->IconIdx(entry);
+    return r;
+}
+
+DirListModel::DirListModel(DirListCtrl *dir_list, wxImageList *icons_image_list) : dir_list_(dir_list) {
+    // Made once, rather than for every row.
+    for (int i = 0; i < icons_image_list->GetImageCount(); ++i) {
+        this->icons_.push_back(icons_image_list->GetIcon(i));
+    }
+}
+
+unsigned int DirListModel::GetColumnCount() const {
+    return 6;
+}
+
+wxString DirListModel::GetColumnType(unsigned int col) const {
+    if (col == 0) {
+        return "wxDataViewIconText";
+    }
+    return "string";
+}
 
-    col = this->dvlc_->AppendTextColumn(" Size", wxDATAVIEW_CELL_INERT);
-    col->SetWidth(100);
+void DirListModel::GetValueByRow(wxVariant &variant, unsigned int row, unsigned int col) const {
+    auto &r = this->dir_list_->Row(row);
+    if (col == 0) {
+        variant << wxDataViewIconText(r.cells[0], this->icons_[r.icon]);
+    } else {
+        variant = r.cells[col];
+    }
+}
 
-    col = this->dvlc_->AppendTextColumn(" Modified", wxDATAVIEW_CELL_INERT);
-    col->SetWidth(150);
+bool DirListModel::SetValueByRow(const wxVariant &variant, unsigned int row, unsigned int col) {
+    return false;  // Cells are not editable.
+}
 
-    col = this->dvlc_->AppendTextColumn(" Mode", wxDATAVIEW_CELL_INERT);
-    col->SetWidth(100);
+bool DirListModel::GetAttrByRow(unsigned int row, unsigned int col, wxDataViewItemAttr &attr) const {
+    if (!this->dir_list_->IsFlashed(row)) {
+        return false;
+    }
+    attr.SetBackgroundColour(flashColour());
+    return true;
+}
 
-    col = this->dvlc_->AppendTextColumn(" Owner", wxDATAVIEW_CELL_INERT, 100);
-    col->SetWidth(100);
+DvlcDirList::DvlcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *icons_image_list) : DirListCtrl(
+        icons_image_list) {
+    this->dvlc_ = new wxDataViewCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize,
+                                     wxDV_ROW_LINES);
+    this->config_ = config;
+    this->model_ = new DirListModel(this, icons_image_list);
+    this->dvlc_->AssociateModel(this->model_.get());
 
-    col = this->dvlc_->AppendTextColumn(" Group", wxDATAVIEW_CELL_INERT, 100);
-    col->SetWidth(100);
+    // TODO(allan): wxDATAVIEW_CELL_EDITABLE for renaming files?
+    this->dvlc_->AppendIconTextColumn("  Name", 0, wxDATAVIEW_CELL_INERT, 300);
+    this->dvlc_->AppendTextColumn(" Size", 1, wxDATAVIEW_CELL_INERT, 100);
+    this->dvlc_->AppendTextColumn(" Modified", 2, wxDATAVIEW_CELL_INERT, 150);
+    this->dvlc_->AppendTextColumn(" Mode", 3, wxDATAVIEW_CELL_INERT, 100);
+    this->dvlc_->AppendTextColumn(" Owner", 4, wxDATAVIEW_CELL_INERT, 100);
+    this->dvlc_->AppendTextColumn(" Group", 5, wxDATAVIEW_CELL_INERT, 100);
 
     this->dvlc_->Bind(wxEVT_DATAVIEW_ITEM_ACTIVATED, [&](wxDataViewEvent &evt) {
         if (!evt.GetItem()) {
@@ -83,25 +203,47 @@ DvlcDirList::DvlcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *ic
     });
 }
 
-void DvlcDirList::Refresh(vector<DirEntry> entries) {
-    bool as_bytes = false;
-    if (this->config_->Read("/size_units", "1") == "2") {
-        as_bytes = true;
+void DvlcDirList::Refresh(const DirListingView &entries) {
+    this->SetEntries(entries);
+    this->model_->Reset(this->entries_.Count());
+}
+
+void DvlcDirList::Append(DirListingSnapshot entries) {
+    this->entries_.Append(entries);
+    // Not Reset, which would drop what the user selected in the rows already shown.
+    for (size_t i = 0 ; i < entries->Count() ; ++i) {
+        this->model_->RowAppended();
     }
+}
 
-    this->dvlc_->DeleteAllItems();
+void DvlcDirList::Patch(const DirListingView &entries, const DirListingDiff &diff) {
+    this->SetEntries(entries);
+    if (diff.reordered) {
+        this->model_->Reset(this->entries_.Count());
+        return;
+    }
 
-    for (int i = 0; i < entries.size(); i++) {
-        wxIcon icon = this->icons_image_list_->GetIcon(this->IconIdx(entries[i]));
+    // With the removed rows gone, the remaining ones are in the new order, and new ones go in between.
+    if (!diff.removed.empty()) {
+        wxArrayInt removed;
+        for (auto i : diff.removed) {
+            removed.Add(i);
+        }
+        this->model_->RowsDeleted(removed);
+    }
+    for (auto i : diff.inserted) {
+        this->model_->RowInserted(i);
+    }
+    for (auto i : diff.updated) {
+        this->model_->RowChanged(i);
+    }
+}
 
-        wxVector<wxVariant> data;
-        data.push_back(wxVariant(wxDataViewIconText(wxString::FromUTF8(entries[i].name_), icon)));
-        data.push_back(wxVariant(entries[i].SizeFormatted(as_bytes)));
-        data.push_back(wxVariant(entries[i].ModifiedFormatted()));
-        data.push_back(wxVariant(entries[i].mode_str_));
-        data.push_back(wxVariant(entries[i].owner_));
-        data.push_back(wxVariant(entries[i].group_));
-        this->dvlc_->AppendItem(data, i);
+void DvlcDirList::RedrawRows(const vector<long> &rows) {
+    for (auto row : rows) {
+        if (row < this->entries_.Count()) {
+            this->model_->RowChanged(row);
+        }
     }
 }
 
@@ -120,33 +262,37 @@ void DvlcDirList::ActivateCurrent() {
 }
 
 vector<int> DvlcDirList::GetSelected() {
+    wxDataViewItemArray a;
+    this->dvlc_->GetSelections(a);
     vector<int> r;
-    for (int i = 0; i < this->dvlc_->GetItemCount(); ++i) {
-        if (this->dvlc_->IsRowSelected(i)) {
-            r.push_back(i);
-        }
+    for (int i = 0; i < a.size(); ++i) {
+        r.push_back(this->model_->GetRow(a[i]));
     }
+    sort(r.begin(), r.end());
     return r;
 }
 
 void DvlcDirList::SetSelected(vector<int> selected) {
     wxDataViewItemArray a;
     for (int i = 0; i < selected.size(); ++i) {
-        a.push_back(this->dvlc_->RowToItem(selected[i]));
+        a.push_back(this->model_->GetItem(selected[i]));
     }
     this->dvlc_->SetSelections(a);
 }
 
 int DvlcDirList::GetHighlighted() {
-    int i = this->dvlc_->ItemToRow(this->dvlc_->GetCurrentItem());
-    if (i < 0) {
+    auto item = this->dvlc_->GetCurrentItem();
+    if (!item.IsOk()) {
         return 0;
     }
-    return i;
+    return this->model_->GetRow(item);
 }
 
 void DvlcDirList::SetHighlighted(int row) {
-    auto item = this->dvlc_->RowToItem(row);
+    if (row < 0 || row >= this->entries_.Count()) {
+        return;
+    }
+    auto item = this->model_->GetItem(row);
     if (item.IsOk()) {
         this->dvlc_->SetCurrentItem(item);
         this->dvlc_->EnsureVisible(item);
@@ -154,14 +300,33 @@ void DvlcDirList::SetHighlighted(int row) {
 }
 
 
+VirtualListCtrl::VirtualListCtrl(wxWindow *parent, DirListCtrl *dir_list) : wxListCtrl(
+        parent,
+        wxID_ANY,
+        wxDefaultPosition,
+        wxDefaultSize,
+        wxLC_REPORT | wxLC_SINGLE_SEL | wxLC_VIRTUAL), dir_list_(dir_list) {
+}
+
+wxString VirtualListCtrl::OnGetItemText(long item, long column) const {
+    return this->dir_list_->Row(item).cells[column];
+}
+
+int VirtualListCtrl::OnGetItemImage(long item) const {
+    return this->dir_list_->Row(item).icon;
+}
+
+wxItemAttr *VirtualListCtrl::OnGetItemAttr(long item) const {
+    if (!this->dir_list_->IsFlashed(item)) {
+        return NULL;
+    }
+    this->flash_attr_.SetBackgroundColour(flashColour());
+    return &this->flash_attr_;
+}
+
 LcDirList::LcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *icons_image_list) : DirListCtrl(
         icons_image_list) {
-    this->list_ctrl_ = new wxListCtrl(
-            parent,
-            wxID_ANY,
-            wxDefaultPosition,
-            wxDefaultSize,
-            wxLC_REPORT | wxLC_SINGLE_SEL);
+    this->list_ctrl_ = new VirtualListCtrl(parent, this);
     this->config_ = config;
 
     this->list_ctrl_->AssignImageList(this->icons_image_list_, wxIMAGE_LIST_SMALL);
@@ -186,23 +351,30 @@ wxControl *LcDirList::GetCtrl() {
     return this->list_ctrl_;
 }
 
-void LcDirList::Refresh(vector<DirEntry> entries) {
-    bool as_bytes = false;
-    if (this->config_->Read("/size_units", "1") == "2") {
-        as_bytes = true;
-    }
+void LcDirList::Refresh(const DirListingView &entries) {
+    this->list_ctrl_->DeleteAllItems();  // Also clears selection and focus.
+    this->SetEntries(entries);
+    this->list_ctrl_->SetItemCount(this->entries_.Count());
+    this->list_ctrl_->Refresh();
+}
+
+void LcDirList::Append(DirListingSnapshot entries) {
+    this->entries_.Append(entries);
+    this->list_ctrl_->SetItemCount(this->entries_.Count());
+}
 
-    this->list_ctrl_->DeleteAllItems();
-
-    for (int i = 0; i < entries.size(); i++) {
-        this->list_ctrl_->InsertItem(i, entries[i].name_, this->IconIdx(entries[i]));
-        this->list_ctrl_->SetItemData(i, i);
-        this->list_ctrl_->SetItem(i, 0, wxString::FromUTF8(entries[i].name_));
-        this->list_ctrl_->SetItem(i, 1, entries[i].SizeFormatted(as_bytes));
-        this->list_ctrl_->SetItem(i, 2, entries[i].ModifiedFormatted());
-        this->list_ctrl_->SetItem(i, 3, entries[i].mode_str_);
-        this->list_ctrl_->SetItem(i, 4, entries[i].owner_);
-        this->list_ctrl_->SetItem(i, 5, entries[i].group_);
+void LcDirList::Patch(const DirListingView &entries, const DirListingDiff &diff) {
+    // Rows are only asked for as they are drawn, so the new count and a redraw is all it takes.
+    this->SetEntries(entries);
+    this->list_ctrl_->SetItemCount(this->entries_.Count());
+    this->list_ctrl_->Refresh();
+}
+
+void LcDirList::RedrawRows(const vector<long> &rows) {
+    for (auto row : rows) {
+        if (row < this->list_ctrl_->GetItemCount()) {
+            this->list_ctrl_->RefreshItem(row);
+        }
     }
 }
 
@@ -217,6 +389,9 @@ void LcDirList::ActivateCurrent() {
 }
 
 void LcDirList::SetSelected(vector<int> selected) {
+    for (auto i : this->GetSelected()) {
+        this->list_ctrl_->SetItemState(i, 0, wxLIST_STATE_SELECTED);
+    }
     for (int i = 0; i < selected.size(); ++i) {
         this->list_ctrl_->SetItemState(selected[i], wxLIST_STATE_SELECTED, wxLIST_STATE_SELECTED);
     }
@@ -241,12 +416,11 @@ int LcDirList::GetHighlighted() {
     if (i < 0) {
         return 0;
     }
-    int j = this->list_ctrl_->GetItemData(i);
-    return j;
+    return i;
 }
 
 void LcDirList::SetHighlighted(int row) {
-    if (row >= this->list_ctrl_->GetItemCount()) {
+    if (row < 0 || row >= this->list_ctrl_->GetItemCount()) {
         return;
     }
 
@@ -13,30 +13,71 @@
 #include <wx/wx.h>
 
 #include <future>  // NOLINT
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/filetypes.h"
 
 using std::function;
+using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 
 typedef function<void(void)> OnItemActivatedCb;
 typedef function<void(int)> OnColumnHeaderClickCb;
 
-// A base class, because wxDataViewListCtrl looks best on MacOS, and wxListCtrl looks best on GTK and Windows.
+// The text of the cells of a row, and its icon.
+struct DirListRow {
+    wxString cells[6];
+    int icon;
+};
+
+// A base class, because wxDataViewCtrl looks best on MacOS, and wxListCtrl looks best on GTK and Windows. Both are
+// used in virtual mode, where they ask for the rows as they are shown, so showing a directory costs the same no matter
+// how many entries it has.
 class DirListCtrl {
 protected:
     OnItemActivatedCb on_item_activated_cb_;
     OnColumnHeaderClickCb on_column_header_click_cb_;
     wxImageList *icons_image_list_;
+    wxConfigBase *config_;
+    DirListingView entries_;
+    bool size_as_bytes_ = false;
+    FileTypes file_types_;
+    unordered_map<long, DirListRow> rows_;  // Rows formatted so far, kept for when they are drawn again.
+    unordered_set<long> flashed_rows_;
+    wxTimer flash_timer_;
+
+    int IconIdx(const DirEntry &entry);
+
+    // Takes over entries, and forgets rows formatted for the previous ones.
+    void SetEntries(const DirListingView &entries);
 
-    int IconIdx(DirEntry entry);
+    // Switches to entries, only inserting, removing and redrawing the rows in diff.
+    virtual void Patch(const DirListingView &entries, const DirListingDiff &diff) = 0;
+
+    virtual void RedrawRows(const vector<long> &rows) = 0;
 
 public:
-    explicit DirListCtrl(wxImageList *icons_image_list) : icons_image_list_(icons_image_list) {
-    }
+    explicit DirListCtrl(wxImageList *icons_image_list);
+
+    virtual void Refresh(const DirListingView &entries) = 0;
+
+    // Adds rows after the existing ones, for example while a directory listing is still arriving.
+    virtual void Append(DirListingSnapshot entries) = 0;
+
+    // Switches to entries, a newer listing of the dir shown, as found by diffListings. Unlike Refresh, the scroll
+    // position stays, selection and highlight follow their entries, and new or changed rows light up for a moment.
+    void Update(const DirListingView &entries, const DirListingDiff &diff);
 
-    virtual void Refresh(vector<DirEntry> entries) = 0;
+    // Formats the given row, if it was not already.
+    const DirListRow &Row(long row);
+
+    // True while the given row is lit up after an Update.
+    bool IsFlashed(long row) const;
 
     virtual wxControl *GetCtrl() = 0;
 
@@ -61,14 +102,40 @@ public:
     }
 };
 
+// Hands rows of a DirListCtrl to a wxDataViewCtrl.
+class DirListModel : public wxDataViewVirtualListModel {
+    DirListCtrl *dir_list_;
+    vector<wxIcon> icons_;
+
+public:
+    DirListModel(DirListCtrl *dir_list, wxImageList *icons_image_list);
+
+    unsigned int GetColumnCount() const override;
+
+    wxString GetColumnType(unsigned int col) const override;
+
+    void GetValueByRow(wxVariant &variant, unsigned int row, unsigned int col) const override;
+
+    bool SetValueByRow(const wxVariant &variant, unsigned int row, unsigned int col) override;
+
+    bool GetAttrByRow(unsigned int row, unsigned int col, wxDataViewItemAttr &attr) const override;
+};
+
 class DvlcDirList : public DirListCtrl {
-    wxDataViewListCtrl *dvlc_;
-    wxConfigBase *config_;
+    wxDataViewCtrl *dvlc_;
+    wxObjectDataPtr<DirListModel> model_;
+
+protected:
+    void Patch(const DirListingView &entries, const DirListingDiff &diff);
+
+    void RedrawRows(const vector<long> &rows);
 
 public:
     explicit DvlcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *icons_image_list);
 
-    void Refresh(vector<DirEntry> entries);
+    void Refresh(const DirListingView &entries);
+
+    void Append(DirListingSnapshot entries);
 
     wxControl *GetCtrl();
 
@@ -85,14 +152,35 @@ public:
     void SetHighlighted(int);
 };
 
+// A wxListCtrl in virtual mode, which gets the rows of a DirListCtrl.
+class VirtualListCtrl : public wxListCtrl {
+    DirListCtrl *dir_list_;
+    mutable wxItemAttr flash_attr_;
+
+public:
+    VirtualListCtrl(wxWindow *parent, DirListCtrl *dir_list);
+
+    wxString OnGetItemText(long item, long column) const override;
+
+    int OnGetItemImage(long item) const override;
+
+    wxItemAttr *OnGetItemAttr(long item) const override;
+};
+
 class LcDirList : public DirListCtrl {
-    wxListCtrl *list_ctrl_;
-    wxConfigBase *config_;
+    VirtualListCtrl *list_ctrl_;
+
+protected:
+    void Patch(const DirListingView &entries, const DirListingDiff &diff);
+
+    void RedrawRows(const vector<long> &rows);
 
 public:
     explicit LcDirList(wxWindow *parent, wxConfigBase *config, wxImageList *icons_image_list);
 
-    void Refresh(vector<DirEntry> entries);
+    void Refresh(const DirListingView &entries);
+
+    void Append(DirListingSnapshot entries);
 
     wxControl *GetCtrl();
 
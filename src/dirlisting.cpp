@@ -0,0 +1,342 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/dirlisting.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/direntry.h"
+
+using std::move;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::upper_bound;
+using std::vector;
+
+uint32_t DirListing::Intern(const string &s) {
+    auto it = this->string_ids_.find(s);
+    if (it != this->string_ids_.end()) {
+        return it->second;
+    }
+    uint32_t id = this->strings_.size();
+    this->strings_.push_back(s);
+    this->string_ids_[s] = id;
+    return id;
+}
+
+size_t DirListing::Count() const {
+    return this->records_.size();
+}
+
+bool DirListing::Empty() const {
+    return this->records_.empty();
+}
+
+void DirListing::Clear() {
+    this->records_.clear();
+    this->names_.clear();
+    this->strings_.clear();
+    this->string_ids_.clear();
+}
+
+void DirListing::Add(const DirEntry &entry) {
+    Record r;
+    r.size = entry.size_;
+    r.modified = entry.modified_;
+    r.mode = entry.mode_;
+    r.uid = entry.uid_;
+    r.gid = entry.gid_;
+    r.name_off = this->names_.size();
+    r.name_len = entry.name_.size();
+    r.owner = this->Intern(entry.owner_);
+    r.group = this->Intern(entry.group_);
+    r.is_dir = entry.is_dir_;
+    this->names_.append(entry.name_);
+    this->records_.push_back(r);
+}
+
+void DirListing::AddRange(const DirListing &other, size_t first, size_t last) {
+    this->records_.reserve(this->records_.size() + (last - first));
+    for (size_t i = first ; i < last ; ++i) {
+        Record r = other.records_[i];
+        r.name_off = this->names_.size();
+        r.owner = this->Intern(other.strings_[r.owner]);
+        r.group = this->Intern(other.strings_[r.group]);
+        this->names_.append(other.names_, other.records_[i].name_off, r.name_len);
+        this->records_.push_back(r);
+    }
+}
+
+void DirListing::Remove(size_t i) {
+    // The name stays behind in names_, which is not worth compacting for the odd removal.
+    this->records_.erase(this->records_.begin() + i);
+}
+
+void DirListing::SetLinkTarget(size_t i, bool is_dir, uint64_t size) {
+    this->records_[i].is_dir = is_dir;
+    this->records_[i].size = size;
+}
+
+DirEntry DirListing::Get(size_t i) const {
+    DirEntry d;
+    d.name_ = string(this->Name(i));
+    d.size_ = this->records_[i].size;
+    d.modified_ = this->records_[i].modified;
+    d.mode_ = this->records_[i].mode;
+    d.mode_str_ = this->ModeString(i);
+    d.uid_ = this->records_[i].uid;
+    d.gid_ = this->records_[i].gid;
+    d.owner_ = this->strings_[this->records_[i].owner];
+    d.group_ = this->strings_[this->records_[i].group];
+    d.is_dir_ = this->records_[i].is_dir;
+    return d;
+}
+
+string_view DirListing::Name(size_t i) const {
+    return string_view(this->names_).substr(this->records_[i].name_off, this->records_[i].name_len);
+}
+
+bool DirListing::IsDir(size_t i) const {
+    return this->records_[i].is_dir;
+}
+
+uint64_t DirListing::FileSize(size_t i) const {
+    return this->records_[i].size;
+}
+
+uint64_t DirListing::Modified(size_t i) const {
+    return this->records_[i].modified;
+}
+
+uint64_t DirListing::Mode(size_t i) const {
+    return this->records_[i].mode;
+}
+
+string DirListing::ModeString(size_t i) const {
+    if (this->records_[i].mode == 0) {
+        return "";  // Not known, for example for the parent dir entry made up when a listing fails.
+    }
+    return modeString(this->records_[i].mode);
+}
+
+uint64_t DirListing::Uid(size_t i) const {
+    return this->records_[i].uid;
+}
+
+uint64_t DirListing::Gid(size_t i) const {
+    return this->records_[i].gid;
+}
+
+string_view DirListing::Owner(size_t i) const {
+    return this->strings_[this->records_[i].owner];
+}
+
+string_view DirListing::Group(size_t i) const {
+    return this->strings_[this->records_[i].group];
+}
+
+bool DirListing::SameEntry(size_t i, const DirListing &other, size_t j) const {
+    auto &a = this->records_[i];
+    auto &b = other.records_[j];
+    return a.size == b.size
+           && a.modified == b.modified
+           && a.mode == b.mode
+           && a.uid == b.uid
+           && a.gid == b.gid
+           && a.is_dir == b.is_dir
+           && this->Name(i) == other.Name(j)
+           && this->Owner(i) == other.Owner(j)
+           && this->Group(i) == other.Group(j);
+}
+
+size_t DirListing::MemoryUsage() const {
+    size_t r = this->records_.capacity() * sizeof(Record) + this->names_.capacity();
+    for (auto &s : this->strings_) {
+        // Each interned string is held twice, and the map adds a node and a bucket.
+        r += 2 * (sizeof(string) + s.capacity()) + 4 * sizeof(void *);
+    }
+    return r;
+}
+
+DirListingView::DirListingView(DirListingSnapshot listing) {
+    this->Append(listing);
+}
+
+void DirListingView::Append(DirListingSnapshot listing) {
+    size_t start = this->part_starts_.empty() ? 0 : this->part_starts_.back() + this->parts_.back()->Count();
+    this->parts_.push_back(listing);
+    this->part_starts_.push_back(start);
+    this->order_.reserve(start + listing->Count());
+    for (size_t i = 0 ; i < listing->Count() ; ++i) {
+        this->order_.push_back(start + i);
+    }
+}
+
+void DirListingView::Clear() {
+    this->parts_.clear();
+    this->part_starts_.clear();
+    this->order_.clear();
+}
+
+size_t DirListingView::Count() const {
+    return this->order_.size();
+}
+
+bool DirListingView::Empty() const {
+    return this->order_.empty();
+}
+
+void DirListingView::Permute(const vector<uint32_t> &rows) {
+    vector<uint32_t> order;
+    order.reserve(rows.size());
+    for (auto row : rows) {
+        order.push_back(this->order_[row]);
+    }
+    this->order_.swap(order);
+}
+
+void DirListingView::SetOrder(vector<uint32_t> order) {
+    this->order_ = move(order);
+}
+
+void DirListingView::Filter(const vector<bool> &keep) {
+    vector<uint32_t> order;
+    for (auto index : this->order_) {
+        if (keep[index]) {
+            order.push_back(index);
+        }
+    }
+    this->order_.swap(order);
+}
+
+DirListingView DirListingView::Unordered() const {
+    DirListingView view;
+    for (auto &part : this->parts_) {
+        view.Append(part);
+    }
+    return view;
+}
+
+bool DirListingView::SameParts(const DirListingView &other) const {
+    return this->parts_ == other.parts_;
+}
+
+// Finds the part holding the entry at row, and the entry's index in it.
+const DirListing &DirListingView::Part(size_t row, size_t *i) const {
+    size_t index = this->order_[row];
+    if (this->parts_.size() == 1) {
+        *i = index;
+        return *this->parts_[0];
+    }
+    size_t part = upper_bound(this->part_starts_.begin(), this->part_starts_.end(), index)
+                  - this->part_starts_.begin() - 1;
+    *i = index - this->part_starts_[part];
+    return *this->parts_[part];
+}
+
+DirEntry DirListingView::Get(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.Get(i);
+}
+
+string_view DirListingView::Name(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.Name(i);
+}
+
+bool DirListingView::IsDir(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.IsDir(i);
+}
+
+uint64_t DirListingView::FileSize(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.FileSize(i);
+}
+
+uint64_t DirListingView::Modified(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.Modified(i);
+}
+
+string DirListingView::ModeString(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.ModeString(i);
+}
+
+string_view DirListingView::Owner(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.Owner(i);
+}
+
+string_view DirListingView::Group(size_t row) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.Group(i);
+}
+
+bool DirListingView::SameEntry(size_t row, const DirListing &other, size_t j) const {
+    size_t i;
+    auto &part = this->Part(row, &i);
+    return part.SameEntry(i, other, j);
+}
+
+bool DirListingView::SameEntry(size_t row, const DirListingView &other, size_t other_row) const {
+    size_t j;
+    auto &other_part = other.Part(other_row, &j);
+    return this->SameEntry(row, other_part, j);
+}
+
+bool DirListingDiff::Empty() const {
+    return this->removed.empty() && this->inserted.empty() && this->updated.empty() && !this->reordered;
+}
+
+DirListingDiff diffListings(const DirListingView &before, const DirListingView &after) {
+    DirListingDiff diff;
+    diff.moved_to.assign(before.Count(), -1);
+
+    unordered_map<string_view, size_t> before_rows;
+    before_rows.reserve(before.Count());
+    for (size_t i = 0 ; i < before.Count() ; ++i) {
+        before_rows[before.Name(i)] = i;
+    }
+
+    int64_t last_kept = -1;
+    for (size_t j = 0 ; j < after.Count() ; ++j) {
+        auto it = before_rows.find(after.Name(j));
+        if (it == before_rows.end()) {
+            diff.inserted.push_back(j);
+            continue;
+        }
+
+        size_t i = it->second;
+        diff.moved_to[i] = j;
+        if (static_cast<int64_t>(i) < last_kept) {
+            diff.reordered = true;
+        }
+        last_kept = i;
+        if (!after.SameEntry(j, before, i)) {
+            diff.updated.push_back(j);
+        }
+    }
+
+    for (size_t i = 0 ; i < before.Count() ; ++i) {
+        if (diff.moved_to[i] < 0) {
+            diff.removed.push_back(i);
+        }
+    }
+    return diff;
+}
@@ -0,0 +1,173 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_DIRLISTING_H_
+#define SRC_DIRLISTING_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "src/direntry.h"
+
+using std::shared_ptr;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::vector;
+
+// The entries of a directory, stored compactly so that directories with millions of entries fit in memory. Each entry
+// is a fixed size record. Names are kept back to back in one buffer, owners and groups are interned, since the same
+// few repeat for every entry, and mode strings are derived from the mode when asked for.
+class DirListing {
+private:
+    struct Record {
+        uint64_t size;
+        uint64_t modified;
+        uint32_t mode;
+        uint32_t uid;
+        uint32_t gid;
+        uint32_t name_off;
+        uint32_t name_len;
+        uint32_t owner;
+        uint32_t group;
+        bool is_dir;
+    };
+
+    vector<Record> records_;
+    string names_;
+    vector<string> strings_;
+    unordered_map<string, uint32_t> string_ids_;
+
+    uint32_t Intern(const string &s);
+
+public:
+    size_t Count() const;
+
+    bool Empty() const;
+
+    void Clear();
+
+    void Add(const DirEntry &entry);
+
+    // Adds the entries from first up to last of other.
+    void AddRange(const DirListing &other, size_t first, size_t last);
+
+    void Remove(size_t i);
+
+    // Records what the symlink at i points at. The mode still says it is a link, but it counts as a dir if the target
+    // is one, and its size becomes that of the target.
+    void SetLinkTarget(size_t i, bool is_dir, uint64_t size);
+
+    // Makes a standalone copy of an entry.
+    DirEntry Get(size_t i) const;
+
+    string_view Name(size_t i) const;
+
+    bool IsDir(size_t i) const;
+
+    uint64_t FileSize(size_t i) const;
+
+    uint64_t Modified(size_t i) const;
+
+    uint64_t Mode(size_t i) const;
+
+    string ModeString(size_t i) const;
+
+    uint64_t Uid(size_t i) const;
+
+    uint64_t Gid(size_t i) const;
+
+    string_view Owner(size_t i) const;
+
+    string_view Group(size_t i) const;
+
+    // True if entry i equals entry j of other.
+    bool SameEntry(size_t i, const DirListing &other, size_t j) const;
+
+    // Approximate number of bytes of heap used.
+    size_t MemoryUsage() const;
+};
+
+// Listings are not changed once complete, so that they can be handed from the SFTP thread to the UI, and be kept in
+// caches, by pointer.
+typedef shared_ptr<const DirListing> DirListingSnapshot;
+
+// The entries of one or more listing snapshots, such as the batches of a listing still arriving, in an order of its
+// own. Entries are addressed by row in that order.
+class DirListingView {
+private:
+    vector<DirListingSnapshot> parts_;
+    vector<size_t> part_starts_;
+    vector<uint32_t> order_;  // Indexes over all parts, one after the other.
+
+    const DirListing &Part(size_t row, size_t *i) const;
+
+public:
+    DirListingView() {}
+
+    explicit DirListingView(DirListingSnapshot listing);
+
+    // Adds the entries of listing after the existing rows.
+    void Append(DirListingSnapshot listing);
+
+    void Clear();
+
+    size_t Count() const;
+
+    bool Empty() const;
+
+    // Reorders the rows so that the one at rows[i] ends up at i.
+    void Permute(const vector<uint32_t> &rows);
+
+    // Sets the rows to the entries at the given indexes, counting through all parts one after the other.
+    void SetOrder(vector<uint32_t> order);
+
+    // Drops the rows whose entries are not marked in keep, which is indexed like SetOrder.
+    void Filter(const vector<bool> &keep);
+
+    // The same entries, in the order they were listed.
+    DirListingView Unordered() const;
+
+    // True if both are of the same listing snapshots.
+    bool SameParts(const DirListingView &other) const;
+
+    DirEntry Get(size_t row) const;
+
+    string_view Name(size_t row) const;
+
+    bool IsDir(size_t row) const;
+
+    uint64_t FileSize(size_t row) const;
+
+    uint64_t Modified(size_t row) const;
+
+    string ModeString(size_t row) const;
+
+    string_view Owner(size_t row) const;
+
+    string_view Group(size_t row) const;
+
+    // True if the entry at row equals entry j of other.
+    bool SameEntry(size_t row, const DirListing &other, size_t j) const;
+
+    // True if the entry at row equals the entry at other_row of other.
+    bool SameEntry(size_t row, const DirListingView &other, size_t other_row) const;
+};
+
+// The rows that differ between two views of the same directory, matched up by name, so that a list showing the
+// before view can be patched into showing the after view.
+struct DirListingDiff {
+    vector<size_t> removed;  // Rows of before that are gone, ascending.
+    vector<size_t> inserted;  // Rows of after that are new, ascending.
+    vector<size_t> updated;  // Rows of after whose entry changed, ascending.
+    vector<int64_t> moved_to;  // The row of after for each row of before, or -1 if removed.
+    bool reordered = false;  // Entries in both are in a different order, so rows can't be patched in place.
+
+    bool Empty() const;
+};
+
+DirListingDiff diffListings(const DirListingView &before, const DirListingView &after);
+
+#endif  // SRC_DIRLISTING_H_
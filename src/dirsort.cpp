@@ -0,0 +1,187 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/dirsort.h"
+
+#include <algorithm>
+#include <future>  // NOLINT
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "src/dirlisting.h"
+
+using std::async;
+using std::future;
+using std::inplace_merge;
+using std::iota;
+using std::launch;
+using std::min;
+using std::reverse;
+using std::sort;
+using std::string;
+using std::string_view;
+using std::thread;
+using std::vector;
+
+// Listings shorter than this are sorted on the calling thread alone.
+#define PARALLEL_SORT_MIN_ROWS 50000
+
+string naturalSortKey(string_view name) {
+    string key;
+    key.reserve(name.size() + 2);
+    for (size_t i = 0 ; i < name.size() ;) {
+        char c = name[i];
+        if (c < '0' || c > '9') {
+            key.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < name.size() && name[i] >= '0' && name[i] <= '9') {
+            i++;
+        }
+        auto digits = name.substr(start, i - start);
+        digits.remove_prefix(min(digits.find_first_not_of('0'), digits.size()));
+
+        // Of two numbers, the one with more digits is bigger, so the length goes before the digits. The '0' in front
+        // keeps numbers sorting where digits do relative to other characters.
+        key.push_back('0');
+        key.push_back(static_cast<char>(min(digits.size(), static_cast<size_t>(255))));
+        key.append(digits.data(), digits.size());
+    }
+    return key;
+}
+
+// Which block of the list a row goes in.
+static uint8_t sortGroup(const DirListingView &l, size_t row, bool dots_first) {
+    auto name = l.Name(row);
+    if (name == "..") {
+        return 0;
+    }
+    bool dot = dots_first && !name.empty() && name[0] == '.';
+    if (l.IsDir(row)) {
+        return dot ? 1 : 2;
+    }
+    return dot ? 3 : 4;
+}
+
+// Sorts long orders in chunks on several threads, and then merges the chunks, also in parallel.
+template<typename Less>
+static void parallelSort(vector<uint32_t> *order, Less less) {
+    size_t n = order->size();
+    size_t threads = thread::hardware_concurrency();
+    if (n < PARALLEL_SORT_MIN_ROWS || threads < 2) {
+        sort(order->begin(), order->end(), less);
+        return;
+    }
+
+    auto begin = order->begin();
+    size_t chunk = (n + threads - 1) / threads;
+    vector<future<void>> sorts;
+    for (size_t start = 0 ; start < n ; start += chunk) {
+        auto first = begin + start;
+        auto last = begin + min(n, start + chunk);
+        sorts.push_back(async(launch::async, [=] { sort(first, last, less); }));
+    }
+    for (auto &f : sorts) {
+        f.get();
+    }
+
+    for (size_t width = chunk ; width < n ; width *= 2) {
+        vector<future<void>> merges;
+        for (size_t start = 0 ; start + width < n ; start += 2 * width) {
+            auto first = begin + start;
+            auto middle = begin + start + width;
+            auto last = begin + min(n, start + 2 * width);
+            merges.push_back(async(launch::async, [=] { inplace_merge(first, middle, last, less); }));
+        }
+        for (auto &f : merges) {
+            f.get();
+        }
+    }
+}
+
+template<typename Key>
+static void sortByGroupAndKey(vector<uint32_t> *order, const vector<uint8_t> &groups, const vector<Key> &keys) {
+    parallelSort(order, [&groups, &keys](uint32_t a, uint32_t b) {
+        if (groups[a] != groups[b]) {
+            return groups[a] < groups[b];
+        }
+        if (keys[a] != keys[b]) {
+            return keys[a] < keys[b];
+        }
+        return a < b;  // Ties stay in listing order, so that reversing gives the descending order.
+    });
+}
+
+DirListSorter::Sorted DirListSorter::SortBy(int column) {
+    auto &l = this->source_;
+    size_t n = l.Count();
+
+    vector<uint8_t> groups(n);
+    for (size_t i = 0 ; i < n ; ++i) {
+        groups[i] = sortGroup(l, i, column == 0);
+    }
+
+    Sorted sorted;
+    sorted.order.resize(n);
+    iota(sorted.order.begin(), sorted.order.end(), 0);
+    if (column == 1 || column == 2) {
+        vector<uint64_t> keys(n);
+        for (size_t i = 0 ; i < n ; ++i) {
+            keys[i] = column == 1 ? l.FileSize(i) : l.Modified(i);
+        }
+        sortByGroupAndKey(&sorted.order, groups, keys);
+    } else if (column == 3) {
+        vector<string> keys(n);
+        for (size_t i = 0 ; i < n ; ++i) {
+            keys[i] = l.ModeString(i);
+        }
+        sortByGroupAndKey(&sorted.order, groups, keys);
+    } else if (column == 4 || column == 5) {
+        vector<string_view> keys(n);
+        for (size_t i = 0 ; i < n ; ++i) {
+            keys[i] = column == 4 ? l.Owner(i) : l.Group(i);
+        }
+        sortByGroupAndKey(&sorted.order, groups, keys);
+    } else {
+        vector<string> keys(n);
+        for (size_t i = 0 ; i < n ; ++i) {
+            keys[i] = naturalSortKey(l.Name(i));
+        }
+        sortByGroupAndKey(&sorted.order, groups, keys);
+    }
+
+    for (size_t i = 1 ; i <= n ; ++i) {
+        if (i == n || groups[sorted.order[i]] != groups[sorted.order[i - 1]]) {
+            sorted.group_ends.push_back(i);
+        }
+    }
+    return sorted;
+}
+
+void DirListSorter::Sort(DirListingView *view, int column, bool desc) {
+    if (!this->source_.SameParts(*view)) {
+        this->source_ = view->Unordered();
+        this->sorted_.clear();
+    }
+
+    auto it = this->sorted_.find(column);
+    if (it == this->sorted_.end()) {
+        it = this->sorted_.emplace(column, this->SortBy(column)).first;
+    }
+
+    // Descending only turns around the order within each group, so ".." and dirs still come first.
+    vector<uint32_t> order = it->second.order;
+    if (desc) {
+        size_t start = 0;
+        for (auto end : it->second.group_ends) {
+            reverse(order.begin() + start, order.begin() + end);
+            start = end;
+        }
+    }
+    view->SetOrder(order);
+}
@@ -0,0 +1,41 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_DIRSORT_H_
+#define SRC_DIRSORT_H_
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/dirlisting.h"
+
+using std::map;
+using std::string;
+using std::string_view;
+using std::vector;
+
+// A key for name that sorts case-insensitively, and runs of digits by their value, so that "file9" comes before
+// "File10".
+string naturalSortKey(string_view name);
+
+// Orders the rows of a listing by a column, the way the dir list shows them: ".." first, then dirs, then files, with
+// dot files first among each when sorting by name. Sort keys are worked out once per column, and the ascending order
+// is kept while the same listing is shown, so sorting by the column again, either way, needs no comparisons.
+class DirListSorter {
+private:
+    struct Sorted {
+        vector<uint32_t> order;
+        vector<size_t> group_ends;  // Where each run of "..", dirs, files and so on ends in order.
+    };
+
+    DirListingView source_;
+    map<int, Sorted> sorted_;
+
+    Sorted SortBy(int column);
+
+public:
+    void Sort(DirListingView *view, int column, bool desc);
+};
+
+#endif  // SRC_DIRSORT_H_
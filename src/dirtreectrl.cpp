@@ -0,0 +1,223 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/dirtreectrl.h"
+
+#ifdef __WXMSW__
+#include <winsock2.h>  // Several header files include windows.h, but winsock2.h needs to come first.
+#endif
+
+#include <wx/dataview.h>
+#include <wx/wx.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/dirlisting.h"
+#include "src/dirsort.h"
+#include "src/paths.h"
+
+using std::make_unique;
+using std::move;
+using std::pair;
+using std::sort;
+using std::string;
+using std::string_view;
+using std::vector;
+
+DirTreeModel::DirTreeModel(wxIcon dir_icon) : dir_icon_(dir_icon) {
+    this->root_.name = "/";
+}
+
+string DirTreeModel::Path(const DirTreeNode *node) {
+    if (!node->parent) {
+        return "/";
+    }
+    return normalize_path(Path(node->parent) + "/" + node->name);
+}
+
+DirTreeNode *DirTreeModel::Find(string path) {
+    path = normalize_path(path);
+    auto node = &this->root_;
+    size_t start = 1;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == string::npos) {
+            end = path.size();
+        }
+        string_view name = string_view(path).substr(start, end - start);
+        start = end + 1;
+
+        DirTreeNode *child = nullptr;
+        for (auto &c : node->children) {
+            if (c->name == name) {
+                child = c.get();
+                break;
+            }
+        }
+        if (!child) {
+            return nullptr;
+        }
+        node = child;
+    }
+    return node;
+}
+
+void DirTreeModel::SetSubdirs(DirTreeNode *node, const DirListing &listing) {
+    vector<pair<string, string>> subdirs;  // Sort key and name.
+    for (size_t i = 0 ; i < listing.Count() ; ++i) {
+        auto name = listing.Name(i);
+        if (listing.IsDir(i) && name != "." && name != "..") {
+            subdirs.emplace_back(naturalSortKey(name), string(name));
+        }
+    }
+    sort(subdirs.begin(), subdirs.end());
+
+    wxDataViewItemArray items;
+    node->children.reserve(subdirs.size());
+    for (auto &subdir : subdirs) {
+        auto child = make_unique<DirTreeNode>();
+        child->name = subdir.second;
+        child->parent = node;
+        items.Add(wxDataViewItem(child.get()));
+        node->children.push_back(move(child));
+    }
+    node->listing = false;
+    node->listed = true;
+
+    if (items.IsEmpty()) {
+        this->ItemChanged(wxDataViewItem(node));  // To lose the expander.
+    } else {
+        this->ItemsAdded(wxDataViewItem(node), items);
+    }
+}
+
+void DirTreeModel::DropSubdirs(DirTreeNode *node) {
+    wxDataViewItemArray items;
+    for (auto &child : node->children) {
+        items.Add(wxDataViewItem(child.get()));
+    }
+    if (!items.IsEmpty()) {
+        this->ItemsDeleted(wxDataViewItem(node), items);
+    }
+    node->children.clear();
+    node->children.shrink_to_fit();
+    node->listing = false;
+    node->listed = false;
+}
+
+void DirTreeModel::CancelListing(DirTreeNode *node) {
+    node->listing = false;
+    for (auto &child : node->children) {
+        this->CancelListing(child.get());
+    }
+}
+
+unsigned int DirTreeModel::GetColumnCount() const {
+    return 1;
+}
+
+wxString DirTreeModel::GetColumnType(unsigned int col) const {
+    return "wxDataViewIconText";
+}
+
+void DirTreeModel::GetValue(wxVariant &variant, const wxDataViewItem &item, unsigned int col) const {
+    auto node = static_cast<DirTreeNode *>(item.GetID());
+    variant << wxDataViewIconText(wxString::FromUTF8(node->name), this->dir_icon_);
+}
+
+bool DirTreeModel::SetValue(const wxVariant &variant, const wxDataViewItem &item, unsigned int col) {
+    return false;  // Cells are not editable.
+}
+
+wxDataViewItem DirTreeModel::GetParent(const wxDataViewItem &item) const {
+    if (!item.IsOk()) {
+        return wxDataViewItem(nullptr);
+    }
+    return wxDataViewItem(static_cast<DirTreeNode *>(item.GetID())->parent);
+}
+
+bool DirTreeModel::IsContainer(const wxDataViewItem &item) const {
+    if (!item.IsOk()) {
+        return true;
+    }
+    // Until listed, any dir may have subdirs.
+    auto node = static_cast<DirTreeNode *>(item.GetID());
+    return !node->listed || !node->children.empty();
+}
+
+unsigned int DirTreeModel::GetChildren(const wxDataViewItem &item, wxDataViewItemArray &children) const {
+    if (!item.IsOk()) {
+        children.Add(wxDataViewItem(const_cast<DirTreeNode *>(&this->root_)));
+        return 1;
+    }
+    auto node = static_cast<DirTreeNode *>(item.GetID());
+    for (auto &child : node->children) {
+        children.Add(wxDataViewItem(child.get()));
+    }
+    return node->children.size();
+}
+
+DirTreeCtrl::DirTreeCtrl(wxWindow *parent, wxIcon dir_icon) {
+    this->dvc_ = new wxDataViewCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxDV_NO_HEADER);
+    this->model_ = new DirTreeModel(dir_icon);
+    this->dvc_->AssociateModel(this->model_.get());
+    this->dvc_->AppendIconTextColumn("Directory", 0, wxDATAVIEW_CELL_INERT, -1);
+
+    // Subdirs are asked for when a dir is expanded, rather than when the control asks for children, which it may do
+    // for dirs not expanded yet.
+    this->dvc_->Bind(wxEVT_DATAVIEW_ITEM_EXPANDING, [&](wxDataViewEvent &evt) {
+        auto node = static_cast<DirTreeNode *>(evt.GetItem().GetID());
+        if (!node || node->listed || node->listing) {
+            return;
+        }
+        node->listing = true;
+
+        // After the event, since subdirs already at hand are added right away, which is best not done mid-expand.
+        auto path = DirTreeModel::Path(node);
+        this->dvc_->CallAfter([this, path]() {
+            if (this->on_list_subdirs_cb_) {
+                this->on_list_subdirs_cb_(path);
+            }
+        });
+    });
+
+    // Collapsed dirs let go of their subdirs, so that the tree doesn't keep growing as it is browsed.
+    this->dvc_->Bind(wxEVT_DATAVIEW_ITEM_COLLAPSED, [&](wxDataViewEvent &evt) {
+        auto node = static_cast<DirTreeNode *>(evt.GetItem().GetID());
+        if (node) {
+            this->model_->DropSubdirs(node);
+        }
+    });
+
+    this->dvc_->Bind(wxEVT_DATAVIEW_SELECTION_CHANGED, [&](wxDataViewEvent &evt) {
+        auto node = static_cast<DirTreeNode *>(evt.GetItem().GetID());
+        if (node && this->on_dir_activated_cb_) {
+            this->on_dir_activated_cb_(DirTreeModel::Path(node));
+        }
+    });
+}
+
+wxControl *DirTreeCtrl::GetCtrl() {
+    return this->dvc_;
+}
+
+void DirTreeCtrl::SetSubdirs(string path, DirListingSnapshot listing) {
+    auto node = this->model_->Find(path);
+    if (!node || !node->listing) {
+        return;  // Collapsed again meanwhile, or not asked for.
+    }
+
+    this->model_->SetSubdirs(node, listing ? *listing : DirListing());
+    if (!node->children.empty()) {
+        // The expand that asked for the subdirs may not have taken, since there were none to show yet.
+        this->dvc_->Expand(wxDataViewItem(node));
+    }
+}
+
+void DirTreeCtrl::CancelListing() {
+    this->model_->CancelListing(this->model_->Root());
+}
@@ -0,0 +1,106 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_DIRTREECTRL_H_
+#define SRC_DIRTREECTRL_H_
+
+#ifdef __WXMSW__
+#include <winsock2.h>  // Several header files include windows.h, but winsock2.h needs to come first.
+#endif
+
+#include <wx/dataview.h>
+#include <wx/wx.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/dirlisting.h"
+
+using std::function;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef function<void(string)> OnDirCb;
+
+// A dir in a DirTreeCtrl. Its subdirs are only known once it has been expanded, and are dropped again when it is
+// collapsed, so the tree only ever holds the nodes that can be shown.
+struct DirTreeNode {
+    string name;
+    DirTreeNode *parent = nullptr;
+    vector<unique_ptr<DirTreeNode>> children;
+    bool listing = false;  // Waiting for its subdirs.
+    bool listed = false;
+};
+
+// Hands the nodes of a DirTreeCtrl to a wxDataViewCtrl, which only asks for the ones it shows.
+class DirTreeModel : public wxDataViewModel {
+    DirTreeNode root_;
+    wxIcon dir_icon_;
+
+public:
+    explicit DirTreeModel(wxIcon dir_icon);
+
+    static string Path(const DirTreeNode *node);
+
+    // Returns nullptr if path is not in the tree, for example because a dir above it was collapsed.
+    DirTreeNode *Find(string path);
+
+    // Adds the subdirs in listing as children of node, sorted by name.
+    void SetSubdirs(DirTreeNode *node, const DirListing &listing);
+
+    void DropSubdirs(DirTreeNode *node);
+
+    // Stops node and the dirs under it from waiting for their subdirs, so that expanding them asks again.
+    void CancelListing(DirTreeNode *node);
+
+    DirTreeNode *Root() {
+        return &this->root_;
+    }
+
+    unsigned int GetColumnCount() const override;
+
+    wxString GetColumnType(unsigned int col) const override;
+
+    void GetValue(wxVariant &variant, const wxDataViewItem &item, unsigned int col) const override;
+
+    bool SetValue(const wxVariant &variant, const wxDataViewItem &item, unsigned int col) override;
+
+    wxDataViewItem GetParent(const wxDataViewItem &item) const override;
+
+    bool IsContainer(const wxDataViewItem &item) const override;
+
+    unsigned int GetChildren(const wxDataViewItem &item, wxDataViewItemArray &children) const override;
+};
+
+// A tree of the remote dirs, to go next to the dir list. Expanding a dir asks for its listing through a callback,
+// which can take its time, as the subdirs are only filled in once SetSubdirs is called.
+class DirTreeCtrl {
+    wxDataViewCtrl *dvc_;
+    wxObjectDataPtr<DirTreeModel> model_;
+    OnDirCb on_list_subdirs_cb_;
+    OnDirCb on_dir_activated_cb_;
+
+public:
+    DirTreeCtrl(wxWindow *parent, wxIcon dir_icon);
+
+    wxControl *GetCtrl();
+
+    // Fills in the subdirs of path, if it is still waiting for them. The listing is nullptr if path could not be
+    // listed.
+    void SetSubdirs(string path, DirListingSnapshot listing);
+
+    // For when the listings asked for won't come, since the connection was lost.
+    void CancelListing();
+
+    void BindOnListSubdirs(OnDirCb cb) {
+        this->on_list_subdirs_cb_ = cb;
+    }
+
+    void BindOnDirActivated(OnDirCb cb) {
+        this->on_dir_activated_cb_ = cb;
+    }
+};
+
+#endif  // SRC_DIRTREECTRL_H_
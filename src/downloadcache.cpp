@@ -0,0 +1,165 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/downloadcache.h"
+
+#ifdef __WXMSW__
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <tuple>
+#include <vector>
+
+#include "src/direntry.h"
+#include "src/string.h"
+
+using std::error_code;
+using std::sort;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::tuple;
+using std::unique_ptr;
+using std::vector;
+using std::filesystem::directory_iterator;
+using std::filesystem::file_time_type;
+
+#define COPY_BUF_SIZE (1024 * 1024)
+
+static FILE *openFile(const string &path, bool write) {
+#ifdef __WXMSW__
+    return _wfopen(localPathUnicode(path).c_str(), write ? L"wb" : L"rb");
+#else
+    return fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+static bool copyFile(const string &src_path, const string &dst_path) {
+    FILE *src = openFile(src_path, false);
+    if (!src) {
+        return false;
+    }
+    FILE *dst = openFile(dst_path, true);
+    if (!dst) {
+        fclose(src);
+        return false;
+    }
+
+    unique_ptr<char[]> buf(new char[COPY_BUF_SIZE]);
+    bool ok = true;
+    size_t n;
+    while (ok && (n = fread(buf.get(), 1, COPY_BUF_SIZE, src)) > 0) {
+        ok = fwrite(buf.get(), 1, n, dst) == n;
+    }
+    ok = !ferror(src) && ok;
+    fclose(src);
+    ok = fclose(dst) == 0 && ok;
+    return ok;
+}
+
+static void removeFile(const string &path) {
+#ifdef __WXMSW__
+    _wremove(localPathUnicode(path).c_str());
+#else
+    remove(path.c_str());
+#endif
+}
+
+static bool renameFile(const string &old_path, const string &new_path) {
+#ifdef __WXMSW__
+    _wremove(localPathUnicode(new_path).c_str());
+    return _wrename(localPathUnicode(old_path).c_str(), localPathUnicode(new_path).c_str()) == 0;
+#else
+    return rename(old_path.c_str(), new_path.c_str()) == 0;
+#endif
+}
+
+// Sets the modified time to now, which is what eviction goes by.
+static bool touchFile(const string &path) {
+#ifdef __WXMSW__
+    return _wutime(localPathUnicode(path).c_str(), NULL) == 0;
+#else
+    return utime(path.c_str(), NULL) == 0;
+#endif
+}
+
+// Removes the least recently used files in dir until the rest add up to no more than max_bytes.
+static void evict(const string &dir, uint64_t max_bytes) {
+    error_code ec;
+    auto it = directory_iterator(localPathUnicode(dir), ec);
+    if (ec) {
+        return;
+    }
+    vector<tuple<file_time_type, uint64_t, string>> files;  // Modified time, size and path.
+    uint64_t total = 0;
+    for (; !ec && it != directory_iterator() ; it.increment(ec)) {
+        error_code stat_ec;
+        uint64_t size = it->file_size(stat_ec);
+        if (stat_ec) {
+            continue;
+        }
+        auto modified = it->last_write_time(stat_ec);
+        if (stat_ec) {
+            continue;
+        }
+        // The names are hex digests, so they come back the same in any encoding.
+        files.emplace_back(modified, size, dir + "/" + it->path().filename().string());
+        total += size;
+    }
+
+    if (total <= max_bytes) {
+        return;
+    }
+    sort(files.begin(), files.end());
+    for (auto &[modified, size, path] : files) {
+        if (total <= max_bytes) {
+            break;
+        }
+        removeFile(path);
+        total -= size;
+    }
+}
+
+DownloadCache::DownloadCache(string dir, uint64_t max_bytes) : dir_(dir), max_bytes_(max_bytes) {}
+
+string DownloadCache::PathOf(const string &remote_path, const DirEntry &remote) const {
+    return this->dir_ + "/" + sha256(remote_path + '\0' + to_string(remote.size_) + ':' + to_string(remote.modified_));
+}
+
+bool DownloadCache::Get(const string &remote_path, const DirEntry &remote, const string &local_path) {
+    string path = this->PathOf(remote_path, remote);
+    if (!touchFile(path)) {
+        return false;  // Not cached.
+    }
+    if (!copyFile(path, local_path)) {
+        removeFile(local_path);
+        return false;
+    }
+    return true;
+}
+
+void DownloadCache::Put(const string &remote_path, const DirEntry &remote, const string &local_path) {
+    // Copied under another name first, so that a half written copy is never used.
+    string path = this->PathOf(remote_path, remote);
+    string tmp_path = path + ".tmp";
+    if (!copyFile(local_path, tmp_path) || !renameFile(tmp_path, path)) {
+        removeFile(tmp_path);
+        return;  // Not being able to keep a copy for next time is not worth bothering the user about.
+    }
+
+    // Eviction only touches the files, so it can go on by itself, even past the end of this object.
+    if (this->evicting_->exchange(true)) {
+        return;  // Already going, and will probably see the new copy.
+    }
+    thread([dir = this->dir_, max_bytes = this->max_bytes_, evicting = this->evicting_]() {
+        evict(dir, max_bytes);
+        *evicting = false;
+    }).detach();
+}
@@ -0,0 +1,42 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_DOWNLOADCACHE_H_
+#define SRC_DOWNLOADCACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "src/direntry.h"
+
+using std::atomic;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+
+// Copies of the files downloaded for editing from one host, kept between runs, so that opening a file not changed
+// remotely since takes only the stat done before downloading.
+//
+// Each copy is named after a hash of the remote path, size and modified time, so a file changed remotely is simply
+// not found, and there is no index to keep in step. Using a copy bumps its modified time, and the least recently used
+// are removed in the background once they add up to more than max_bytes.
+class DownloadCache {
+private:
+    string dir_;
+    uint64_t max_bytes_;
+    shared_ptr<atomic<bool>> evicting_ = make_shared<atomic<bool>>(false);
+
+    string PathOf(const string &remote_path, const DirEntry &remote) const;
+
+public:
+    DownloadCache(string dir, uint64_t max_bytes);
+
+    // Copies the cached copy of remote_path to local_path, if there is one of the same size and modified time as
+    // remote.
+    bool Get(const string &remote_path, const DirEntry &remote, const string &local_path);
+
+    // Keeps a copy of local_path, which was just downloaded from remote_path.
+    void Put(const string &remote_path, const DirEntry &remote, const string &local_path);
+};
+
+#endif  // SRC_DOWNLOADCACHE_H_
@@ -6,7 +6,9 @@
 #include <wx/artprov.h>
 #include <wx/config.h>
 #include <wx/display.h>
+#include <wx/fswatcher.h>
 #include <wx/preferences.h>
+#include <wx/splitter.h>
 #include <wx/stdpaths.h>
 #include <wx/wx.h>
 
@@ -19,6 +21,7 @@
 #include <stack>
 #include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #ifndef __WXOSX__
@@ -30,24 +33,35 @@
 #include "./version.h"
 #include "src/artprovider.h"
 #include "src/channel.h"
+#include "src/dircache.h"
 #include "src/direntry.h"
 #include "src/dirlistctrl.h"
+#include "src/dirlisting.h"
+#include "src/dirtreectrl.h"
+#include "src/downloadcache.h"
 #include "src/hostdesc.h"
 #include "src/ids.h"
 #include "src/licensestrings.h"
+#include "src/listingstore.h"
 #include "src/passworddialog.h"
 #include "src/paths.h"
 #include "src/preferencespanel.h"
 #include "src/sftpthread.h"
 #include "src/string.h"
 #include "src/storageunits.h"
+#include "src/transferpool.h"
 
 using std::chrono::seconds;
+using std::find;
 using std::future;
+using std::get_if;
 using std::launch;
 using std::make_shared;
 using std::make_unique;
 using std::map;
+using std::move;
+using std::nullopt;
+using std::optional;
 using std::regex;
 using std::regex_search;
 using std::shared_ptr;
@@ -62,10 +76,49 @@ using std::unordered_set;
 #else
 using std::filesystem::create_directories;
 using std::filesystem::exists;
+using std::filesystem::file_size;
 using std::filesystem::file_time_type;
 using std::filesystem::last_write_time;
 #endif
 
+// Listings cached for the current connection are shown immediately, and only listed again when older than this.
+#define DIR_CACHE_TTL_SECONDS 15
+#define DIR_CACHE_MAX_ENTRIES 200000
+// Listings are kept between runs in one file per host, in this dir under the user's config dir.
+#ifdef __WXMSW__
+#define LISTING_STORE_DIR "filesremote_listings"
+#else
+#define LISTING_STORE_DIR ".filesremote_listings"
+#endif
+#define LISTING_STORE_MAX_ENTRIES 500000
+// Files downloaded for editing are also kept between runs, in a dir per host under this dir in the user's config dir,
+// up to this many megabytes per host.
+#ifdef __WXMSW__
+#define DOWNLOAD_CACHE_DIR "filesremote_downloads"
+#else
+#define DOWNLOAD_CACHE_DIR ".filesremote_downloads"
+#endif
+#define DOWNLOAD_CACHE_MAX_MB 512
+// Subdirs of the current dir are listed in the background while idle, up to this many dirs and entries at a time.
+#define PREFETCH_MAX_DIRS 8
+#define PREFETCH_MAX_ENTRIES 20000
+// Saves to opened files are uploaded once the size and modified time stay the same for this long, as editors often
+// write a file several times in a row when saving.
+#define FILE_SETTLE_MS 100
+// Dirs of opened files that can't be watched, for example with the inotify watch limit reached, are polled this often.
+#define FILE_POLL_MS 1000
+
+// How often to check whether opened files were changed remotely by someone else.
+#define REMOTE_CHECK_SECONDS 30
+
+// Describes how much was sent over the wire, when it differs from the file size due to compression.
+static string transferSizeSuffix(uint64_t wire_bytes, uint64_t file_bytes) {
+    if (wire_bytes == file_bytes) {
+        return "";
+    }
+    return " (" + size_string(wire_bytes) + " transferred for " + size_string(file_bytes) + ")";
+}
+
 // Drag and drop for uploading.
 class DnDFile : public wxFileDropTarget {
     function<bool(const wxArrayString &filenames)> on_drop_files_cb_;
@@ -86,7 +139,7 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         wxEmptyString,
         wxPoint(-1, -1),
         wxSize(800, 600)
-) {
+), dir_cache_(DIR_CACHE_MAX_ENTRIES) {
     this->config_ = config;
 
 #ifdef __WXMSW__
@@ -139,7 +192,7 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         }
 
         int item = this->dir_list_ctrl_->GetHighlighted();
-        auto entry = this->current_dir_list_[item];
+        auto entry = this->current_dir_list_.Get(item);
         if (entry.is_dir_) {
             return;
         }
@@ -195,6 +248,9 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
     file_menu->Append(ID_CANCEL, "&Cancel current transfer\tESC", "Cancel the current upload or download");
     this->Bind(wxEVT_MENU, [&](wxCommandEvent &event) {
         this->cancellation_channel_->Put(true);
+        if (this->transfer_pool_) {
+            this->transfer_pool_->Cancel();
+        }
     }, ID_CANCEL);
 
     file_menu->Append(ID_RENAME, "&Rename\tF2", "Rename currently selected file or directory");
@@ -204,7 +260,7 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         }
 
         int item = this->dir_list_ctrl_->GetHighlighted();
-        auto entry = this->current_dir_list_[item];
+        auto entry = this->current_dir_list_.Get(item);
 
         wxTextEntryDialog dialog(
                 this,
@@ -240,7 +296,7 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         }
 
         int item = this->dir_list_ctrl_->GetHighlighted();
-        auto entry = this->current_dir_list_[item];
+        auto entry = this->current_dir_list_.Get(item);
 
         auto s = wxString::FromUTF8("Permanently delete " + entry.name_ + "?");
         wxMessageDialog dialog(this, s, "Confirm deletion", wxYES_NO | wxICON_ERROR | wxCENTER);
@@ -346,12 +402,12 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
     menuBar->Append(go_menu, "&Go");
 
     // Adding refresh to the menu twice with two different hotkeys, instead of using SetAcceleratorTable.
-    // It's wonky, but MacOS has trouble with non-menu accelerators when the wxDataViewListCtrl has focus.
+    // It's wonky, but MacOS has trouble with non-menu accelerators when the wxDataViewCtrl has focus.
     go_menu->Append(wxID_REFRESH, "Refresh\tF5");
     go_menu->Append(wxID_REFRESH, "Refresh\tCtrl+R");
     this->Bind(wxEVT_MENU, [&](wxCommandEvent &event) {
         this->latest_interesting_status_ = "";
-        this->RefreshDir(this->current_dir_, true);
+        this->RefreshDir(this->current_dir_, true, true);
     }, wxID_REFRESH);
 
     go_menu->Append(ID_SET_DIR, "Change directory\tCtrl+L");
@@ -360,6 +416,18 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         this->path_text_ctrl_->SelectAll();
     }, ID_SET_DIR);
 
+    go_menu->Append(ID_FILTER, "Filter\tCtrl+F");
+    this->Bind(wxEVT_MENU, [&](wxCommandEvent &) {
+        this->filter_text_ctrl_->SetFocus();
+        this->filter_text_ctrl_->SelectAll();
+    }, ID_FILTER);
+
+    go_menu->AppendCheckItem(ID_SHOW_DIR_TREE, "Show directory tree");
+    go_menu->Check(ID_SHOW_DIR_TREE, this->config_->Read("/show_dir_tree", "1") == "1");
+    this->Bind(wxEVT_MENU, [&](wxCommandEvent &event) {
+        this->ShowDirTree(event.IsChecked());
+    }, ID_SHOW_DIR_TREE);
+
 #ifdef __WXOSX__
     go_menu->Append(ID_PARENT_DIR, "Parent directory\tCtrl+Up", wxEmptyString, wxITEM_NORMAL);
 #else
@@ -458,13 +526,14 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
 
     // Most keyboard accelerators for menu items are automatically bound via the string in its title. However, some
     // seem to only work via SetAcceleratorTable, so setting them again here.
-    // MacOS seems to ignores this table when the focus is on wxDataViewListCtrl, so we rely on the accelerators in
+    // MacOS seems to ignores this table when the focus is on wxDataViewCtrl, so we rely on the accelerators in
     // the menu item titles on MacOS.
 #ifndef __WXOSX__
     vector<wxAcceleratorEntry> entries{
             wxAcceleratorEntry(wxACCEL_NORMAL, WXK_F5, wxID_REFRESH),
             wxAcceleratorEntry(wxACCEL_CTRL, 'R', wxID_REFRESH),
             wxAcceleratorEntry(wxACCEL_CTRL, 'L', ID_SET_DIR),
+            wxAcceleratorEntry(wxACCEL_CTRL, 'F', ID_FILTER),
             wxAcceleratorEntry(wxACCEL_ALT, WXK_UP, ID_PARENT_DIR),
             wxAcceleratorEntry(wxACCEL_ALT, WXK_LEFT, wxID_BACKWARD),
             wxAcceleratorEntry(wxACCEL_ALT, WXK_RIGHT, wxID_FORWARD),
@@ -479,9 +548,14 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
     this->SetAcceleratorTable(accel);
 #endif
 
-    // Set up a timer that will watch for changes in local files.
+    // Changes to opened files are watched for with file_watcher_, which is set up with the first file opened. This timer
+    // only runs while saves are settling, or to get back to those that came while busy.
     this->file_watcher_timer_.Bind(wxEVT_TIMER, &FileManagerFrame::OnFileWatcherTimer, this);
-    this->file_watcher_timer_.Start(1000);
+    this->file_poll_timer_.Bind(wxEVT_TIMER, &FileManagerFrame::OnFilePollTimer, this);
+
+    // Opened files are also checked for remote changes every now and then, and again right before each upload.
+    this->remote_check_timer_.Bind(wxEVT_TIMER, &FileManagerFrame::OnRemoteCheckTimer, this);
+    this->remote_check_timer_.Start(REMOTE_CHECK_SECONDS * 1000);
 
     // Main layout.
     auto *panel = new wxPanel(this);
@@ -622,6 +696,53 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         evt.Skip();
     });
 
+    // Create the quick filter field, which narrows the list to the entries matching it as it is typed in.
+    this->filter_text_ctrl_ = new wxTextCtrl(
+            panel,
+            wxID_ANY,
+            wxEmptyString,
+            wxDefaultPosition,
+            this->FromDIP(wxSize(160, -1)),
+            wxTE_PROCESS_ENTER);
+    this->filter_text_ctrl_->SetHint("Filter");
+    sizer_inner_top->Add(this->filter_text_ctrl_, 0, wxEXPAND | wxALL, 4);
+    this->filter_mode_choice_ = new wxChoice(panel, wxID_ANY);
+    this->filter_mode_choice_->Append("Contains");  // Same order as NameFilterMode.
+    this->filter_mode_choice_->Append("Glob");
+    this->filter_mode_choice_->Append("Fuzzy");
+    this->filter_mode_choice_->SetSelection(NAME_FILTER_SUBSTRING);
+    sizer_inner_top->Add(this->filter_mode_choice_, 0, wxALIGN_CENTER_VERTICAL | wxALL, 4);
+
+    this->filter_text_ctrl_->Bind(wxEVT_TEXT, [&](wxCommandEvent &event) {
+        this->ApplyFilter();
+    });
+
+    this->filter_mode_choice_->Bind(wxEVT_CHOICE, [&](wxCommandEvent &event) {
+        if (!this->filter_text_ctrl_->IsEmpty()) {
+            this->ApplyFilter();
+        }
+    });
+
+    // Handle when pressing enter while focused on the filter field, to go on to the first match.
+    this->filter_text_ctrl_->Bind(wxEVT_TEXT_ENTER, [&](wxCommandEvent &event) {
+        this->dir_list_ctrl_->SetFocus();
+    });
+
+    // Handle when pressing ESC or down while focused on the filter field.
+    this->filter_text_ctrl_->Bind(wxEVT_CHAR_HOOK, [&](wxKeyEvent &evt) {
+        if (evt.GetModifiers() == 0 && evt.GetKeyCode() == WXK_ESCAPE && this->filter_text_ctrl_->HasFocus()) {
+            this->filter_text_ctrl_->Clear();  // Which shows all entries again.
+            this->dir_list_ctrl_->SetFocus();
+            return;
+        }
+        if (evt.GetModifiers() == 0 && evt.GetKeyCode() == WXK_DOWN && this->filter_text_ctrl_->HasFocus()) {
+            this->dir_list_ctrl_->SetFocus();
+            return;
+        }
+
+        evt.Skip();
+    });
+
     auto icon_size = this->FromDIP(wxSize(16, 16));
     auto icons_image_list = new wxImageList(icon_size.GetWidth(), icon_size.GetHeight(), false, 1);
     icons_image_list->Add(this->GetBitmap(wxART_NORMAL_FILE, wxART_LIST, icon_size));
@@ -631,16 +752,42 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
     icons_image_list->Add(this->GetBitmap("_file_picture", wxART_LIST, icon_size));
     icons_image_list->Add(this->GetBitmap("_package", wxART_LIST, icon_size));
 
+    // The dir tree and the dir list share the space below the path, with a sash between them.
+    this->splitter_ = new wxSplitterWindow(panel, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxSP_LIVE_UPDATE);
+    this->splitter_->SetMinimumPaneSize(this->FromDIP(80));
+    this->splitter_->SetSashGravity(0);
+    this->dir_tree_ctrl_ = new DirTreeCtrl(this->splitter_, icons_image_list->GetIcon(1));
+
 #ifdef __WXOSX__
-    // On MacOS wxDataViewListCtrl looks best.
-    this->dir_list_ctrl_ = new DvlcDirList(panel, this->config_, icons_image_list);
+    // On MacOS wxDataViewCtrl looks best.
+    this->dir_list_ctrl_ = new DvlcDirList(this->splitter_, this->config_, icons_image_list);
 #else
     // On GTK and Windows wxListCtrl looks best.
-    this->dir_list_ctrl_ = new LcDirList(panel, this->config_, icons_image_list);
+    this->dir_list_ctrl_ = new LcDirList(this->splitter_, this->config_, icons_image_list);
 #endif
-    sizer->Add(this->dir_list_ctrl_->GetCtrl(), 1, wxEXPAND | wxALL, 0);
+    this->dir_tree_ctrl_->GetCtrl()->Hide();
+    this->splitter_->Initialize(this->dir_list_ctrl_->GetCtrl());
+    this->ShowDirTree(this->config_->Read("/show_dir_tree", "1") == "1");
+    sizer->Add(this->splitter_, 1, wxEXPAND | wxALL, 0);
     this->dir_list_ctrl_->SetFocus();
 
+    // Subdirs are taken from listings already fetched when there are any, and listed by the sftp thread otherwise.
+    this->dir_tree_ctrl_->BindOnListSubdirs([&](string path) {
+        auto cached = this->dir_cache_.Get(path);
+        if (cached) {
+            this->dir_tree_ctrl_->SetSubdirs(path, cached);
+            return;
+        }
+        this->sftp_thread_channel_->Put(SftpThreadCmdListSubdirs{path, this->BulkListing()});
+    });
+
+    this->dir_tree_ctrl_->BindOnDirActivated([&](string path) {
+        if (path != this->current_dir_) {
+            this->latest_interesting_status_ = "";
+            this->ChangeDir(path);
+        }
+    });
+
     this->dir_list_ctrl_->BindOnItemActivated([&](void) {
         this->OnItemActivated();
     });
@@ -679,6 +826,11 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
         this->SetStatusText("Disconnecting...");
         this->busy_cursor_ = make_unique<wxBusyCursor>();
 
+        // Listings seen as root are not kept around.
+        if (this->listing_store_ && !this->sudo_) {
+            this->listing_store_->Save(this->dir_cache_, LISTING_STORE_MAX_ENTRIES);
+        }
+
         if (this->sftp_thread_channel_) {
             this->sftp_thread_channel_->Put(SftpThreadCmdShutdown{});
             this->cancellation_channel_->Put(true);
@@ -690,6 +842,7 @@ FileManagerFrame::FileManagerFrame(wxConfigBase *config) : wxFrame(
 
             this->sftp_thread_.release();
         }
+        this->transfer_pool_ = nullptr;
 
         // Save frame position.
         int x, y, w, h;
@@ -756,6 +909,23 @@ void FileManagerFrame::Connect(HostDesc host_desc, wxSecretValue passwd_param, s
     // Use a sub tmp directory with the name of this connection.
     this->local_tmp_ = normalize_path(local_tmp + "/" + this->host_desc_.ToStringNoCol());
 
+    string store_dir = normalize_path(
+            wxStandardPaths::Get().GetUserConfigDir().ToStdString(wxMBConvUTF8()) + "/" + LISTING_STORE_DIR);
+    create_directories(localPathUnicode(store_dir));
+    this->listing_store_ = make_unique<ListingStore>(
+            normalize_path(store_dir + "/" + this->host_desc_.ToStringNoCol()));
+
+    string cache_dir = normalize_path(
+            wxStandardPaths::Get().GetUserConfigDir().ToStdString(wxMBConvUTF8()) + "/" + DOWNLOAD_CACHE_DIR + "/"
+            + this->host_desc_.ToStringNoCol());
+    create_directories(localPathUnicode(cache_dir));
+    this->download_cache_ = make_shared<DownloadCache>(cache_dir, DOWNLOAD_CACHE_MAX_MB * 1024ULL * 1024);
+
+    // Transfer sessions are only opened once needed, and the number allowed is taken as it is when connecting.
+    int transfer_sessions = this->config_->Read("/transfer_sessions", 2);
+    this->transfer_pool_ = make_unique<TransferPool>(
+            this, this->host_desc_, transfer_sessions > 0 ? transfer_sessions : 0);
+
     this->RefreshTitle();
 
     // Start the sftp thread. We will be communicating with it only through message passing.
@@ -766,7 +936,8 @@ void FileManagerFrame::Connect(HostDesc host_desc, wxSecretValue passwd_param, s
                     sftpThreadFunc,
                     this,
                     this->sftp_thread_channel_,
-                    this->cancellation_channel_));
+                    this->cancellation_channel_,
+                    0));
     this->sftp_thread_channel_->Put(SftpThreadCmdConnect{this->host_desc_});
     this->busy_cursor_ = make_unique<wxBusyCursor>();
     this->SetStatusText("Connecting...");
@@ -777,13 +948,19 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
         this->busy_cursor_ = nullptr;
         auto r = event.GetPayload<SftpThreadResponseConnected>();
+        this->transfer_pool_->SetSession(r.session);
 
         // Was this a reconnect after a dropped connection?
         if (!this->home_dir_.empty()) {
-            // Reset all upload_requested-flags.
+            this->dir_tree_ctrl_->CancelListing();
+
+            // Reset all upload_requested-flags, and check for saves that didn't make it up before the connection dropped.
             for (auto o : this->opened_files_local_) {
                 this->opened_files_local_[o.first].upload_requested = false;
+                this->opened_files_local_[o.first].upload_superseded = false;
+                this->changed_opened_files_.insert(o.first);
             }
+            this->file_watcher_timer_.StartOnce(FILE_SETTLE_MS);
 
             if (this->sudo_) {
                 this->sftp_thread_channel_->Put(SftpThreadCmdSudo{});
@@ -858,10 +1035,40 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
         this->busy_cursor_ = make_unique<wxBusyCursor>();
     }, ID_SFTP_THREAD_RESPONSE_NEED_PASSWD);
 
+    // Sftp thread will trigger this callback with the entries listed so far while listing a directory.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        auto r = event.GetPayload<SftpThreadResponseGetDirPartial>();
+        if (r.seq != this->dir_listing_seq_ || this->showing_cached_) {
+            return;  // Left over from a listing that was superseded, or the cached listing is shown meanwhile.
+        }
+
+        // A filtered list is only filled in once the listing is complete, since new rows would be unfiltered.
+        if (this->filter_text_ctrl_->IsEmpty()) {
+            int first_new = this->current_dir_list_.Count();
+            this->current_dir_list_.Append(r.new_entries);
+            this->dir_list_ctrl_->Append(r.new_entries);
+
+            for (int i = first_new ; i < this->current_dir_list_.Count() ; ++i) {
+                if (this->current_dir_list_.Name(i) == this->stored_highlighted_) {
+                    this->dir_list_ctrl_->SetHighlighted(i);
+                }
+            }
+        }
+
+        this->SetStatusText(wxString::FromUTF8(
+                "Retrieving directory list, " + to_string(this->current_dir_list_.Count()) + " items so far..."));
+    }, ID_SFTP_THREAD_RESPONSE_GET_DIR_PARTIAL);
+
     // Sftp thread will trigger this callback after successfully getting a directory list.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
         auto r = event.GetPayload<SftpThreadResponseGetDir>();
+        if (!r.cancelled) {
+            this->dir_cache_.Put(r.dir, r.dir_list);
+        }
+        if (r.seq != this->dir_listing_seq_) {
+            return;  // Left over from a listing that was superseded.
+        }
+        this->listing_in_progress_ = false;
 
         // Requested dir changed meanwhile.
         if (this->current_dir_ != r.dir) {
@@ -869,24 +1076,77 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
             return;
         }
 
-        this->current_dir_list_ = r.dir_list;
-        this->path_text_ctrl_->SetValue(wxString::FromUTF8(r.dir));
-        this->SortAndPopulateDir();
-        this->RecallSelected();
-        if (this->latest_interesting_status_.empty()) {
+        if (this->showing_cached_) {
+            // The cached listing stays up, with the entries that turned out different patched in.
+            this->showing_cached_ = false;
+            if (!r.cancelled) {
+                this->UpdateDir(r.dir_list);
+            }
+        } else {
+            if (!this->current_dir_list_.Empty()) {
+                // Keep what the user highlighted or selected while the entries were arriving.
+                bool stored_highlighted_shown = false;
+                for (size_t i = 0 ; i < this->current_dir_list_.Count() ; ++i) {
+                    if (this->current_dir_list_.Name(i) == this->stored_highlighted_) {
+                        stored_highlighted_shown = true;
+                        break;
+                    }
+                }
+                if (this->stored_highlighted_.empty() || stored_highlighted_shown) {
+                    this->stored_highlighted_ = string(
+                            this->current_dir_list_.Name(this->dir_list_ctrl_->GetHighlighted()));
+                }
+                for (auto i : this->dir_list_ctrl_->GetSelected()) {
+                    this->stored_selected_.insert(string(this->current_dir_list_.Name(i)));
+                }
+            }
+
+            this->current_dir_list_ = DirListingView(r.dir_list);
+            this->path_text_ctrl_->SetValue(wxString::FromUTF8(r.dir));
+            this->SortAndPopulateDir();
+            this->RecallSelected();
+        }
+        if (r.cancelled) {
+            this->latest_interesting_status_ = "Cancelled directory listing.";
+        } else if (this->latest_interesting_status_.empty()) {
             auto d = wxDateTime::Now().FormatISOCombined(' ');
-            this->latest_interesting_status_ = "Refreshed dir list at " + d + ".";
+            this->latest_interesting_status_ = "Refreshed dir list at " + d + " (" + to_string(r.dir_list->Count())
+                                               + " entries in " + to_string(r.listing_ms) + " ms, "
+                                               + size_string(r.dir_list->MemoryUsage()) + " in memory).";
         }
         this->SetIdleStatusText();
+        if (!r.cancelled) {
+            this->PrefetchSubdirs();
+        }
     }, ID_SFTP_THREAD_RESPONSE_GET_DIR);
 
+    // Sftp thread will trigger this callback for each dir it listed in the background.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        auto r = event.GetPayload<SftpThreadResponsePrefetched>();
+        this->dir_cache_.Put(r.dir, r.dir_list);
+    }, ID_SFTP_THREAD_RESPONSE_PREFETCHED);
+
+    // Sftp thread will trigger this callback with the listing of a dir expanded in the dir tree.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        auto r = event.GetPayload<SftpThreadResponseSubdirs>();
+        if (r.dir_list && !r.dirs_only) {
+            this->dir_cache_.Put(r.dir, r.dir_list);
+        }
+        this->dir_tree_ctrl_->SetSubdirs(r.dir, r.dir_list);
+    }, ID_SFTP_THREAD_RESPONSE_SUBDIRS);
+
     // Sftp thread will trigger this callback after successfully downloading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseDownload>();
 
         string d = string(wxDateTime::Now().FormatISOCombined(' '));
-        this->latest_interesting_status_ = "Downloaded " + r.remote_path + " at " + d + ".";
+        if (r.from_cache) {
+            this->latest_interesting_status_ = "Opened " + r.remote_path + " from the local cache at " + d + ".";
+        } else {
+            this->latest_interesting_status_ = "Downloaded " + r.remote_path + " at " + d
+                                               + transferSizeSuffix(r.wire_bytes, r.file_bytes) + ".";
+        }
         this->RefreshDir(this->current_dir_, true);
 
         if (!r.open_in_editor) {
@@ -898,12 +1158,18 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
             // Previously downloaded, so just update the modified time.
 
             this->opened_files_local_[r.remote_path].modified = last_write_time(localPathUnicode(r.local_path));
+            this->opened_files_local_[r.remote_path].remote = r.entry;
+            this->opened_files_local_[r.remote_path].remote_changed = false;
+            this->opened_files_local_[r.remote_path].hash = r.hash;
         } else {
             OpenedFile f;
             f.local_path = r.local_path;
             f.remote_path = r.remote_path;
             f.modified = last_write_time(localPathUnicode(r.local_path));
+            f.remote = r.entry;
+            f.hash = r.hash;
             this->opened_files_local_[r.remote_path] = f;
+            this->WatchOpenedFile(r.local_path);
         }
 
         string editor = string(this->config_->Read("/editor", ""));
@@ -921,27 +1187,105 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback after successfully uploading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseUpload>();
 
         string d = string(wxDateTime::Now().FormatISOCombined(' '));
-        this->latest_interesting_status_ = "Uploaded " + r.remote_path + " at " + d + ".";
-        this->RefreshDir(this->current_dir_, true);
-
-        if (this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end()) {
-            // TODO(allan): catch if a file gets written again after the upload starts but before it completes
-            auto local_path = this->opened_files_local_[r.remote_path].local_path;
-            this->opened_files_local_[r.remote_path].modified = last_write_time(localPathUnicode(local_path));
-            this->opened_files_local_[r.remote_path].upload_requested = false;
+        this->latest_interesting_status_ = "Uploaded " + r.remote_path + " at " + d
+                                           + transferSizeSuffix(r.wire_bytes, r.file_bytes) + ".";
+        this->dir_cache_.Patch(r.remote_path, r.entry);
+        this->RefreshDir(this->current_dir_, true, !r.entry.has_value());
+
+        // Opened files are only uploaded on the browsing connection, so an upload on a transfer session is some other
+        // file uploaded there.
+        bool opened = this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end();
+        if (event.GetInt() == 0 && opened) {
+            // Only the version uploaded is up to date remotely, so a save that came after the upload started is
+            // uploaded next.
+            auto &f = this->opened_files_local_[r.remote_path];
+            f.modified = f.uploading;
+            f.upload_requested = false;
+            f.upload_superseded = false;
+            f.remote = r.entry;
+            f.remote_changed = false;
+            f.hash = r.hash;
+            this->changed_opened_files_.insert(r.remote_path);
+            this->CheckChangedOpenedFiles();
         }
     }, ID_SFTP_THREAD_RESPONSE_UPLOAD);
 
-    // Sftp thread will trigger this callback when a transfer was successfully cancelled by the user.
+    // Sftp thread will trigger this callback instead of uploading an opened file that was saved without changes.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
         this->busy_cursor_ = nullptr;
-        this->latest_interesting_status_ = "Cancelled transfer.";
+        auto r = event.GetPayload<SftpThreadResponseUploadUnchanged>();
         this->SetIdleStatusText();
-        this->RefreshDir(this->current_dir_, true);
+        if (this->opened_files_local_.find(r.remote_path) == this->opened_files_local_.end()) {
+            return;
+        }
+        auto &f = this->opened_files_local_[r.remote_path];
+        f.modified = f.uploading;
+        f.upload_requested = false;
+        f.upload_superseded = false;
+        this->changed_opened_files_.insert(r.remote_path);
+        this->CheckChangedOpenedFiles();
+    }, ID_SFTP_THREAD_RESPONSE_UPLOAD_UNCHANGED);
+
+    // Sftp thread will trigger this callback after stat'ing the opened files.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        this->remote_check_pending_ = false;
+        auto r = event.GetPayload<SftpThreadResponseStatOpened>();
+        for (size_t i = 0 ; i < r.remote_paths.size() ; ++i) {
+            auto it = this->opened_files_local_.find(r.remote_paths[i]);
+            if (it == this->opened_files_local_.end() || !r.entries[i].has_value()) {
+                continue;  // Closed, or gone remotely. An upload would put it back.
+            }
+            auto &f = it->second;
+            if (!f.remote.has_value() || f.remote_changed || f.upload_requested) {
+                continue;
+            }
+            if (f.remote->SameVersion(*r.entries[i])) {
+                continue;
+            }
+            this->ResolveRemoteChange(f.remote_path, *r.entries[i]);
+        }
+    }, ID_SFTP_THREAD_RESPONSE_STAT_OPENED);
+
+    // Sftp thread will trigger this callback instead of uploading an opened file that someone else changed remotely.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        this->busy_cursor_ = nullptr;
+        auto r = event.GetPayload<SftpThreadResponseRemoteChanged>();
+        this->SetIdleStatusText();
+        if (this->opened_files_local_.find(r.remote_path) == this->opened_files_local_.end()) {
+            return;
+        }
+        this->opened_files_local_[r.remote_path].upload_requested = false;
+        this->opened_files_local_[r.remote_path].upload_superseded = false;
+        this->ResolveRemoteChange(r.remote_path, r.entry);
+    }, ID_SFTP_THREAD_RESPONSE_REMOTE_CHANGED);
+
+    // Sftp thread will trigger this callback when a transfer was successfully cancelled by the user.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        this->CommandDone(event);
+
+        // An upload of an opened file cancelled for a newer save is redone with that.
+        bool superseded = false;
+        for (auto &o : this->opened_files_local_) {
+            if (event.GetInt() == 0 && o.second.upload_requested) {
+                o.second.upload_requested = false;
+                if (o.second.upload_superseded) {
+                    o.second.upload_superseded = false;
+                    this->changed_opened_files_.insert(o.first);
+                    superseded = true;
+                }
+            }
+        }
+
+        if (!superseded) {
+            this->latest_interesting_status_ = "Cancelled transfer.";
+            this->SetIdleStatusText();
+        }
+        this->RefreshDir(this->current_dir_, true, true);  // A partially uploaded file may have been left behind.
+        this->CheckChangedOpenedFiles();
     }, ID_SFTP_THREAD_RESPONSE_CANCELLED);
 
     // Sftp thread will trigger this callback to indicate progress while uploading a file.
@@ -965,7 +1309,7 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
     // Sftp thread will trigger this callback when we need to follow a directory symlink.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
         auto r = event.GetPayload<SftpThreadResponseFollowSymlinkDir>();
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         this->latest_interesting_status_ = "Followed directory symlink: " + r.symlink_path;
         this->ChangeDir(r.real_path);
     }, ID_SFTP_THREAD_RESPONSE_FOLLOW_SYMLINK_DIR);
@@ -984,14 +1328,13 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback on general errors while downloading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
         auto s = wxString::FromUTF8("Failed to download " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_ERROR | wxCENTER);
         dialog.SetYesNoLabels("Retry", "Ignore");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(r.cmd);
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->RetryCommand(event, r.cmd);
         } else {
             // User requested to ignore this download failure.
             this->SetStatusText(s);
@@ -1000,14 +1343,13 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback on permission errors while downloading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
         auto s = wxString::FromUTF8("Permission denied when downloading " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_ERROR | wxCENTER);
         dialog.SetYesNoLabels("Retry", "Ignore");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(r.cmd);
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->RetryCommand(event, r.cmd);
         } else {
             // User requested to ignore this download failure.
             this->SetStatusText(s);
@@ -1016,20 +1358,21 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback on general errors while uploading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
         auto s = wxString::FromUTF8("Failed to upload " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_ERROR | wxCENTER);
         dialog.SetYesNoLabels("Retry", "Ignore");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(r.cmd);
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->RetryCommand(event, r.cmd);
         } else {
             // User requested to ignore this upload failure.
-            if (this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end()) {
+            bool opened = this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end();
+            if (event.GetInt() == 0 && opened) {
                 auto local_path = this->opened_files_local_[r.remote_path].local_path;
                 this->opened_files_local_[r.remote_path].modified = last_write_time(localPathUnicode(local_path));
                 this->opened_files_local_[r.remote_path].upload_requested = false;
+                this->opened_files_local_[r.remote_path].upload_superseded = false;
                 this->SetStatusText(s);
             }
         }
@@ -1037,20 +1380,21 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback on permission errors on a remote file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
         auto s = wxString::FromUTF8("Permission denied on " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_ERROR | wxCENTER);
         dialog.SetYesNoLabels("Retry", "Ignore");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(r.cmd);
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->RetryCommand(event, r.cmd);
         } else {
             // User requested to ignore this upload failure.
-            if (this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end()) {
+            bool opened = this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end();
+            if (event.GetInt() == 0 && opened) {
                 auto local_path = this->opened_files_local_[r.remote_path].local_path;
                 this->opened_files_local_[r.remote_path].modified = last_write_time(localPathUnicode(local_path));
                 this->opened_files_local_[r.remote_path].upload_requested = false;
+                this->opened_files_local_[r.remote_path].upload_superseded = false;
                 this->SetStatusText(s);
             }
         }
@@ -1058,20 +1402,21 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback on disk space errors while uploading a file.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
         auto s = wxString::FromUTF8("Insufficient disk space failure while uploading " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_ERROR | wxCENTER);
         dialog.SetYesNoLabels("Retry", "Ignore");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(r.cmd);
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->RetryCommand(event, r.cmd);
         } else {
             // User requested to ignore this upload failure.
-            if (this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end()) {
+            bool opened = this->opened_files_local_.find(r.remote_path) != this->opened_files_local_.end();
+            if (event.GetInt() == 0 && opened) {
                 auto local_path = this->opened_files_local_[r.remote_path].local_path;
                 this->opened_files_local_[r.remote_path].modified = last_write_time(localPathUnicode(local_path));
                 this->opened_files_local_[r.remote_path].upload_requested = false;
+                this->opened_files_local_[r.remote_path].upload_superseded = false;
                 this->SetStatusText(s);
             }
         }
@@ -1079,14 +1424,13 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback when confirmation for overwriting a file is needed.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseConfirmOverwrite>();
         auto s = wxString::FromUTF8("Remote file already exists: " + r.remote_path);
         wxMessageDialog dialog(this, s, "Error", wxYES_NO | wxICON_QUESTION | wxCENTER);
         dialog.SetYesNoLabels("Replace", "Cancel");
         if (dialog.ShowModal() == wxID_YES) {
-            this->sftp_thread_channel_->Put(SftpThreadCmdUploadOverwrite{r.local_path, r.remote_path});
-            this->busy_cursor_ = make_unique<wxBusyCursor>();
+            this->StartTransfer(SftpThreadCmdUploadOverwrite{r.local_path, r.remote_path, this->CompressTransfers()});
         }
     }, ID_SFTP_THREAD_RESPONSE_CONFIRM_OVERWRITE);
 
@@ -1094,13 +1438,23 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
         this->busy_cursor_ = nullptr;
         auto r = event.GetPayload<SftpThreadResponseFileError>();
+        auto get_dir = get_if<SftpThreadCmdGetDir>(&r.cmd);
+        if (get_dir && get_dir->seq != this->dir_listing_seq_) {
+            return;  // Left over from a listing that was superseded.
+        }
+        if (get_dir) {
+            this->listing_in_progress_ = false;
+            this->showing_cached_ = false;
+        }
 
         // Make a dummy parent dir entry to make it easy to get back to the parent dir.
-        if (this->current_dir_list_.size() == 0) {
+        if (this->current_dir_list_.Empty()) {
             DirEntry parent_dir_entry;
             parent_dir_entry.name_ = "..";
             parent_dir_entry.is_dir_ = true;
-            this->dir_list_ctrl_->Refresh(vector<DirEntry>{parent_dir_entry});
+            auto parent_dir_listing = make_shared<DirListing>();
+            parent_dir_listing->Add(parent_dir_entry);
+            this->dir_list_ctrl_->Refresh(DirListingView(parent_dir_listing));
         }
 
         auto s = wxString::FromUTF8("Permission denied while listing directory " + r.remote_path);
@@ -1117,12 +1471,14 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
         // Set highligted to be either after or before the deleted item.
         int highlighted = this->dir_list_ctrl_->GetHighlighted();
-        if (highlighted + 1 < this->current_dir_list_.size()) {
+        if (highlighted + 1 < this->current_dir_list_.Count()) {
             this->dir_list_ctrl_->SetHighlighted(highlighted + 1);
         } else {
             this->dir_list_ctrl_->SetHighlighted(highlighted - 1);
         }
 
+        auto r = event.GetPayload<SftpThreadResponseSuccess>();
+        this->dir_cache_.Patch(get_if<SftpThreadCmdDelete>(&r.cmd)->remote_path, nullopt);
         this->RefreshDir(this->current_dir_, true);
     }, ID_SFTP_THREAD_RESPONSE_DELETE_SUCCEEDED);
 
@@ -1139,15 +1495,26 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback when a file or directory was not found.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseFileError>();
+        auto get_dir = get_if<SftpThreadCmdGetDir>(&r.cmd);
+        if (get_dir && get_dir->seq != this->dir_listing_seq_) {
+            return;  // Left over from a listing that was superseded.
+        }
+        if (get_dir) {
+            this->listing_in_progress_ = false;
+            this->showing_cached_ = false;
+            this->dir_cache_.Patch(get_dir->dir, nullopt);
+        }
 
         // Make a dummy parent dir entry to make it easy to get back to the parent dir.
-        if (this->current_dir_list_.size() == 0) {
+        if (this->current_dir_list_.Empty()) {
             DirEntry parent_dir_entry;
             parent_dir_entry.name_ = "..";
             parent_dir_entry.is_dir_ = true;
-            this->dir_list_ctrl_->Refresh(vector<DirEntry>{parent_dir_entry});
+            auto parent_dir_listing = make_shared<DirListing>();
+            parent_dir_listing->Add(parent_dir_entry);
+            this->dir_list_ctrl_->Refresh(DirListingView(parent_dir_listing));
         }
 
         auto s = wxString::FromUTF8("File or directory not found: " + r.remote_path);
@@ -1158,7 +1525,7 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback when a directory with the requested name already exists.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
-        this->busy_cursor_ = nullptr;
+        this->CommandDone(event);
         auto r = event.GetPayload<SftpThreadResponseDirectoryAlreadyExists>();
 
         auto s = wxString::FromUTF8("Directory already exists: " + r.remote_path);
@@ -1169,6 +1536,9 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback when sudo required a password.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        if (event.GetInt() != 0) {
+            return;  // Sudo is only asked for on the browsing connection, and transfer sessions just follow it.
+        }
         this->busy_cursor_ = nullptr;
         auto passwd = this->passwd_param_;
         if (!passwd.IsOk()) {
@@ -1183,22 +1553,31 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
                 return;
             }
         }
+        this->sudo_passwd_ = passwd;
         this->sftp_thread_channel_->Put(SftpThreadCmdSudo{passwd});
         this->busy_cursor_ = make_unique<wxBusyCursor>();
     }, ID_SFTP_THREAD_RESPONSE_SUDO_NEEDS_PASSWD);
 
     // Sftp thread will trigger this callback when sudo elevation succeeds.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        if (event.GetInt() != 0) {
+            return;  // As for ID_SFTP_THREAD_RESPONSE_SUDO_NEEDS_PASSWD.
+        }
         this->busy_cursor_ = nullptr;
         this->sudo_ = true;
+        this->transfer_pool_->SetSudo(true, this->sudo_passwd_);
         this->tool_bar_->ToggleTool(this->sudo_btn_->GetId(), this->sudo_);
         this->RefreshTitle();
         this->SetIdleStatusText();
+        this->dir_cache_.Clear();  // Listings depend on who we are.
         this->RefreshDir(this->current_dir_, true);
     }, ID_SFTP_THREAD_RESPONSE_SUDO_SUCCEEDED);
 
     // Sftp thread will trigger this callback when sudo elevation fails.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        if (event.GetInt() != 0) {
+            return;  // As for ID_SFTP_THREAD_RESPONSE_SUDO_NEEDS_PASSWD.
+        }
         this->busy_cursor_ = nullptr;
         this->sudo_ = false;
         this->tool_bar_->ToggleTool(this->sudo_btn_->GetId(), this->sudo_);
@@ -1215,11 +1594,17 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
 
     // Sftp thread will trigger this callback when sudo exit succeeds.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        if (event.GetInt() != 0) {
+            return;  // As for ID_SFTP_THREAD_RESPONSE_SUDO_NEEDS_PASSWD.
+        }
         this->busy_cursor_ = nullptr;
         this->sudo_ = false;
+        this->sudo_passwd_ = wxSecretValue();
+        this->transfer_pool_->SetSudo(false, wxSecretValue());
         this->tool_bar_->ToggleTool(this->sudo_btn_->GetId(), this->sudo_);
         this->RefreshTitle();
         this->SetIdleStatusText();
+        this->dir_cache_.Clear();  // Listings depend on who we are.
         this->RefreshDir(this->current_dir_, true);
     }, ID_SFTP_THREAD_RESPONSE_SUDO_EXIT_SUCCEEDED);
 
@@ -1228,12 +1613,54 @@ void FileManagerFrame::SetupSftpThreadCallbacks() {
         this->busy_cursor_ = nullptr;
         this->latest_interesting_status_ = "";
         this->SetIdleStatusText();
-        this->RefreshDir(this->current_dir_, true);
+
+        // Patch the cached listing with what we changed, rather than listing the directory again.
+        auto r = event.GetPayload<SftpThreadResponseSuccess>();
+        auto rename_cmd = get_if<SftpThreadCmdRename>(&r.cmd);
+        auto mkdir_cmd = get_if<SftpThreadCmdMkdir>(&r.cmd);
+        auto mkfile_cmd = get_if<SftpThreadCmdMkfile>(&r.cmd);
+        string remote_path;
+        if (rename_cmd) {
+            this->dir_cache_.Patch(rename_cmd->remote_old_path, nullopt);
+            remote_path = rename_cmd->remote_new_path;
+        } else if (mkdir_cmd) {
+            remote_path = mkdir_cmd->remote_path;
+        } else if (mkfile_cmd) {
+            remote_path = mkfile_cmd->remote_path;
+        }
+        if (!remote_path.empty()) {
+            this->dir_cache_.Patch(remote_path, r.entry);
+        }
+        this->RefreshDir(this->current_dir_, true, !r.entry.has_value());
     }, ID_SFTP_THREAD_RESPONSE_SUCCESS);
 
+    // Sftp thread of a transfer session will trigger this callback once it is connected.
+    this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        this->transfer_pool_->Connected(event.GetInt());
+    }, ID_SFTP_THREAD_RESPONSE_POOL_CONNECTED);
+
     // Sftp thread will trigger this callback on an error that requires us to reconnect.
     this->Bind(wxEVT_THREAD, [&](wxThreadEvent &event) {
+        if (event.GetInt() != 0) {
+            // A transfer session is just opened again for the next transfer, and the browsing connection carries on.
+            auto r = event.GetPayload<SftpThreadResponseError>();
+            this->latest_interesting_status_ = "Transfer failed: " + PrettifySentence(r.error);
+            auto fallback = this->transfer_pool_->Failed(event.GetInt());
+            for (auto &cmd : fallback) {
+                this->sftp_thread_channel_->Put(cmd);
+                this->busy_cursor_ = make_unique<wxBusyCursor>();
+            }
+            if (!this->busy_cursor_) {
+                this->SetIdleStatusText();
+            }
+            return;
+        }
+
         this->busy_cursor_ = make_unique<wxBusyCursor>();
+        this->listing_in_progress_ = false;
+        this->showing_cached_ = false;
+        this->remote_check_pending_ = false;
+        this->dir_tree_ctrl_->CancelListing();
         this->RequestUserAttention(wxUSER_ATTENTION_ERROR);
         auto r = event.GetPayload<SftpThreadResponseError>();
         auto error = PrettifySentence(r.error);
@@ -1264,7 +1691,7 @@ void FileManagerFrame::OnItemActivated() {
     }
 
     int item = this->dir_list_ctrl_->GetHighlighted();
-    auto entry = this->current_dir_list_[item];
+    auto entry = this->current_dir_list_.Get(item);
     auto path = normalize_path(this->current_dir_ + "/" + entry.name_);
     if (entry.is_dir_) {
         this->ChangeDir(path);
@@ -1284,13 +1711,13 @@ void FileManagerFrame::ChangeDir(string path) {
 
     this->current_dir_ = path;
     this->path_text_ctrl_->SetValue(wxString::FromUTF8(path));
-    this->current_dir_list_.clear();
-    this->dir_list_ctrl_->Refresh(vector<DirEntry>{});
+    this->current_dir_list_.Clear();
+    this->dir_list_ctrl_->Refresh(DirListingView());
     this->RefreshDir(path, false);
 }
 
 void FileManagerFrame::SetIdleStatusText() {
-    string s = to_string(this->current_dir_list_.size()) + " items";
+    string s = to_string(this->current_dir_list_.Count()) + " items";
     if (!this->latest_interesting_status_.empty()) {
         s += ". " + this->latest_interesting_status_;
     }
@@ -1309,8 +1736,12 @@ void FileManagerFrame::RefreshTitle() {
 
 void FileManagerFrame::UploadWatchedFile(string remote_path) {
     OpenedFile f = this->opened_files_local_[remote_path];
-    this->sftp_thread_channel_->Put(SftpThreadCmdUploadOverwrite{f.local_path, f.remote_path});
+    this->sftp_thread_channel_->Put(SftpThreadCmdUploadOverwrite{
+            f.local_path, f.remote_path, this->CompressTransfers(), f.remote, true, f.hash});
     this->opened_files_local_[f.remote_path].upload_requested = true;
+    this->opened_files_local_[f.remote_path].upload_superseded = false;
+    // Taken before the upload reads the file, so a write that sneaks in is newer than this and gets uploaded too.
+    this->opened_files_local_[f.remote_path].uploading = last_write_time(localPathUnicode(f.local_path));
     this->SetStatusText(wxString::FromUTF8("Uploading " + f.remote_path + " ... Press Esc to cancel."));
     this->busy_cursor_ = make_unique<wxBusyCursor>();
 }
@@ -1318,45 +1749,210 @@ void FileManagerFrame::UploadWatchedFile(string remote_path) {
 void FileManagerFrame::UploadFile(string local_path) {
     string name = basename(local_path);
     string remote_path = normalize_path(this->current_dir_ + "/" + name);
-    this->sftp_thread_channel_->Put(SftpThreadCmdUpload{local_path, remote_path});
+    this->StartTransfer(SftpThreadCmdUpload{local_path, remote_path, this->CompressTransfers()});
     this->SetStatusText(wxString::FromUTF8("Uploading " + remote_path) + " ... Press Esc to cancel.");
+}
+
+void FileManagerFrame::StartTransfer(threadFuncVariant cmd) {
+    if (this->transfer_pool_ && this->transfer_pool_->Available()) {
+        this->transfer_pool_->Put(cmd);
+        return;
+    }
+    this->sftp_thread_channel_->Put(cmd);
     this->busy_cursor_ = make_unique<wxBusyCursor>();
 }
 
-void FileManagerFrame::OnFileWatcherTimer(const wxTimerEvent &event) {
-    if (this->busy_cursor_) {
+void FileManagerFrame::CommandDone(const wxThreadEvent &event) {
+    if (event.GetInt() == 0) {
+        this->busy_cursor_ = nullptr;
+    } else {
+        this->transfer_pool_->Done(event.GetInt());
+    }
+}
+
+void FileManagerFrame::RetryCommand(const wxThreadEvent &event, threadFuncVariant cmd) {
+    if (event.GetInt() == 0) {
+        this->sftp_thread_channel_->Put(cmd);
+        this->busy_cursor_ = make_unique<wxBusyCursor>();
+    } else {
+        this->transfer_pool_->Put(cmd);
+    }
+}
+
+void FileManagerFrame::WatchOpenedFile(string local_path) {
+    if (!this->file_watcher_) {
+        // Made only now, as it needs the event loop to be running.
+        this->file_watcher_ = make_unique<wxFileSystemWatcher>();
+        this->file_watcher_->SetOwner(this);
+        this->Bind(wxEVT_FSWATCHER, &FileManagerFrame::OnFileWatcherEvent, this);
+    }
+
+    // The dir rather than the file, as editors often save by writing a new file and renaming it over the old one.
+    string dir = normalize_path(local_path + "/..");
+    if (this->watched_dirs_.find(dir) != this->watched_dirs_.end()
+        || this->polled_dirs_.find(dir) != this->polled_dirs_.end()) {
+        return;
+    }
+    if (this->file_watcher_->Add(wxFileName::DirName(wxString::FromUTF8(dir)),
+                                 wxFSW_EVENT_CREATE | wxFSW_EVENT_RENAME | wxFSW_EVENT_MODIFY)) {
+        this->watched_dirs_.insert(dir);
         return;
     }
 
-    for (auto o : this->opened_files_local_) {
-        OpenedFile f = o.second;
-        auto local_path = f.local_path;
-        if (!exists(localPathUnicode(local_path))) {
+    this->polled_dirs_.insert(dir);
+    if (!this->file_poll_timer_.IsRunning()) {
+        this->file_poll_timer_.Start(FILE_POLL_MS);
+    }
+}
+
+void FileManagerFrame::OnFileWatcherEvent(wxFileSystemWatcherEvent &event) {
+    auto changed = event.GetChangeType() == wxFSW_EVENT_RENAME ? event.GetNewPath() : event.GetPath();
+    auto path = normalize_path(changed.GetFullPath().ToStdString(wxMBConvUTF8()));
+
+    // Some platforms only tell which dir changed, rather than which file in it.
+    for (auto &o : this->opened_files_local_) {
+        if (o.second.local_path == path || normalize_path(o.second.local_path + "/..") == path) {
+            this->changed_opened_files_.insert(o.first);
+        }
+    }
+    this->CheckChangedOpenedFiles();
+}
+
+void FileManagerFrame::CheckChangedOpenedFiles() {
+    for (auto it = this->changed_opened_files_.begin() ; it != this->changed_opened_files_.end() ;) {
+        auto opened = this->opened_files_local_.find(*it);
+        if (opened == this->opened_files_local_.end()) {
+            it = this->changed_opened_files_.erase(it);
+            continue;
+        }
+        OpenedFile &f = opened->second;
+        auto local_path = localPathUnicode(f.local_path);
+        if (!exists(local_path)) {
+            it = this->changed_opened_files_.erase(it);
             continue;  // File was deleted by something externally. Nothing we can do about that.
         }
-        if (!f.upload_requested && last_write_time(localPathUnicode(local_path)) > f.modified) {
+        auto size = file_size(local_path);
+        auto modified = last_write_time(local_path);
+
+        if (f.upload_requested) {
+            // Stays until the upload finishes or is cancelled, and then goes up as soon as it has settled.
+            if (modified > f.uploading && !f.upload_superseded) {
+                f.upload_superseded = true;
+                this->cancellation_channel_->Put(true);
+            }
+            ++it;
+            continue;
+        }
+
+        if (size != f.seen_size || modified != f.seen_modified) {
+            f.seen_size = size;
+            f.seen_modified = modified;
+            ++it;
+            continue;  // Still being written, perhaps.
+        }
+        if (this->busy_cursor_) {
+            ++it;
+            continue;
+        }
+
+        it = this->changed_opened_files_.erase(it);
+        if (modified > f.modified) {
             this->UploadWatchedFile(f.remote_path);
         }
     }
+
+    if (!this->changed_opened_files_.empty()) {
+        this->file_watcher_timer_.StartOnce(FILE_SETTLE_MS);
+    }
+}
+
+void FileManagerFrame::OnFileWatcherTimer(const wxTimerEvent &event) {
+    this->CheckChangedOpenedFiles();
+}
+
+void FileManagerFrame::OnFilePollTimer(const wxTimerEvent &event) {
+    for (auto &o : this->opened_files_local_) {
+        if (this->polled_dirs_.find(normalize_path(o.second.local_path + "/..")) != this->polled_dirs_.end()) {
+            this->changed_opened_files_.insert(o.first);
+        }
+    }
+    this->CheckChangedOpenedFiles();
+}
+
+void FileManagerFrame::OnRemoteCheckTimer(const wxTimerEvent &event) {
+    // Left for next time while busy, also with reconnecting, so as not to hold up what the user is waiting for.
+    if (this->remote_check_pending_ || this->busy_cursor_ || this->listing_in_progress_ || this->home_dir_.empty()) {
+        return;
+    }
+
+    vector<string> remote_paths;
+    for (auto &o : this->opened_files_local_) {
+        if (o.second.remote.has_value() && !o.second.remote_changed && !o.second.upload_requested) {
+            remote_paths.push_back(o.first);
+        }
+    }
+    if (remote_paths.empty()) {
+        return;
+    }
+    this->sftp_thread_channel_->Put(SftpThreadCmdStatOpened{remote_paths});
+    this->remote_check_pending_ = true;
+}
+
+void FileManagerFrame::ResolveRemoteChange(string remote_path, DirEntry remote) {
+    auto &f = this->opened_files_local_[remote_path];
+    f.hash = nullopt;  // Whatever is on the server now is not what was downloaded.
+    string merge_path = f.local_path + ".remote";
+    auto s = wxString::FromUTF8(
+            remote_path + " was changed on the server since you opened it.\n\n"
+            + "Reload replaces your copy with the one on the server. Overwrite uploads your copy over it. Merge "
+            + "downloads the one on the server to " + merge_path
+            + ", and uploads your copy the next time you save it.");
+    wxMessageDialog dialog(this, s, "File changed remotely", wxYES_NO | wxCANCEL | wxHELP | wxICON_WARNING | wxCENTER);
+    dialog.SetYesNoCancelLabels("Reload", "Overwrite", "Later");
+    dialog.SetHelpLabel("Merge");
+    switch (dialog.ShowModal()) {
+        case wxID_YES:
+            f.remote_changed = false;
+            this->DownloadFileForEdit(remote_path);
+            break;
+        case wxID_NO:
+            // Uploaded once the local copy settles, even if it was not saved since downloaded.
+            f.remote = remote;
+            f.remote_changed = false;
+            f.modified = file_time_type();
+            this->changed_opened_files_.insert(remote_path);
+            this->CheckChangedOpenedFiles();
+            break;
+        case wxID_HELP:
+            f.remote = remote;
+            f.remote_changed = false;
+            this->DownloadFile(remote_path, merge_path);
+            break;
+        default:
+            // Asked again with the next save, rather than every time the opened files are checked.
+            f.remote_changed = true;
+            break;
+    }
 }
 
 void FileManagerFrame::RememberSelected() {
-    this->stored_highlighted_ = this->current_dir_list_[this->dir_list_ctrl_->GetHighlighted()].name_;
+    this->stored_highlighted_ = string(this->current_dir_list_.Name(this->dir_list_ctrl_->GetHighlighted()));
     this->stored_selected_.clear();
     auto r = this->dir_list_ctrl_->GetSelected();
     for (int i = 0 ; i < r.size() ; ++i) {
-        this->stored_selected_.insert(this->current_dir_list_[r[i]].name_);
+        this->stored_selected_.insert(string(this->current_dir_list_.Name(r[i])));
     }
 }
 
 void FileManagerFrame::RecallSelected() {
     int highlighted = 0;
     vector<int> selected;
-    for (int i = 0 ; i < this->current_dir_list_.size() ; ++i) {
-        if (this->stored_selected_.find(this->current_dir_list_[i].name_) != this->stored_selected_.end()) {
+    for (int i = 0 ; i < this->current_dir_list_.Count() ; ++i) {
+        string name(this->current_dir_list_.Name(i));
+        if (this->stored_selected_.find(name) != this->stored_selected_.end()) {
             selected.push_back(i);
         }
-        if (this->current_dir_list_[i].name_ == this->stored_highlighted_) {
+        if (name == this->stored_highlighted_) {
             highlighted = i;
         }
     }
@@ -1364,78 +1960,181 @@ void FileManagerFrame::RecallSelected() {
     this->dir_list_ctrl_->SetSelected(selected);
 }
 
-void FileManagerFrame::RefreshDir(string remote_path, bool preserve_selection) {
+void FileManagerFrame::RefreshDir(string remote_path, bool preserve_selection, bool force) {
     if (this->busy_cursor_) {
         return;
-    } else {
-        this->busy_cursor_ = make_unique<wxBusyCursor>();
     }
 
-    this->SetStatusText("Retrieving directory list...");
-
     if (preserve_selection) {
-        this->RememberSelected();
+        if (!this->current_dir_list_.Empty()) {
+            this->RememberSelected();
+        }
     } else {
         this->stored_selected_.clear();
         this->stored_highlighted_ = "";
+        this->filter_text_ctrl_->ChangeValue("");  // A filter is for the dir it was typed in.
     }
 
-    this->current_dir_list_.clear();
-    this->SortAndPopulateDir();
+    // A listing still in progress is for a directory we navigated away from, or is about to be redone anyway.
+    if (this->listing_in_progress_) {
+        this->cancellation_channel_->Put(true);
+        this->listing_in_progress_ = false;
+    }
+    this->dir_listing_seq_++;
+
+    // Fall back to listings stored by an earlier run, which are always listed again.
+    auto cached = this->dir_cache_.Get(remote_path);
+    optional<time_t> stored_at;
+    if (!cached && this->listing_store_ && !this->sudo_) {
+        auto stored = this->listing_store_->Get(remote_path);
+        if (stored.has_value()) {
+            cached = make_shared<const DirListing>(move(stored->entries));
+            stored_at = stored->fetched;
+        }
+    }
 
-    this->sftp_thread_channel_->Put(SftpThreadCmdGetDir{remote_path});
-}
+    // Refreshing the dir shown, for example after changing something in it, only touches the rows that differ.
+    bool in_place = preserve_selection && !this->current_dir_list_.Empty();
 
-void FileManagerFrame::SortAndPopulateDir() {
-    auto cmp = [&](const DirEntry &a, const DirEntry &b) {
-        if (a.name_ == "..") { return true; }
-        if (b.name_ == "..") { return false; }
-        if (a.is_dir_ && !b.is_dir_) { return true; }
-        if (!a.is_dir_ && b.is_dir_) { return false; }
-
-        string a_val, b_val;
-        if (this->sort_column_ == 1) {
-            if (this->sort_desc_) {
-                return a.size_ > b.size_;
-            }
-            return a.size_ < b.size_;
-        } else if (this->sort_column_ == 2) {
-            if (this->sort_desc_) {
-                return a.modified_ > b.modified_;
-            }
-            return a.modified_ < b.modified_;
-        } else if (this->sort_column_ == 3) {
-            if (this->sort_desc_) {
-                return a.mode_str_ > b.mode_str_;
-            }
-            return a.mode_str_ < b.mode_str_;
-        } else if (this->sort_column_ == 4) {
-            if (this->sort_desc_) {
-                return a.owner_ > b.owner_;
-            }
-            return a.owner_ < b.owner_;
-        } else if (this->sort_column_ == 5) {
-            if (this->sort_desc_) {
-                return a.group_ > b.group_;
-            }
-            return a.group_ < b.group_;
+    this->showing_cached_ = cached != nullptr;
+    if (cached) {
+        if (in_place) {
+            this->UpdateDir(cached);
+        } else {
+            this->current_dir_list_ = DirListingView(cached);
+            this->path_text_ctrl_->SetValue(wxString::FromUTF8(remote_path));
+            this->SortAndPopulateDir();
+            this->RecallSelected();
+        }
+        if (!stored_at.has_value() && !force
+            && this->dir_cache_.IsFresh(remote_path, seconds(DIR_CACHE_TTL_SECONDS))) {
+            this->showing_cached_ = false;
+            this->SetIdleStatusText();
+            this->PrefetchSubdirs();
+            return;
+        }
+
+        string s = to_string(this->current_dir_list_.Count()) + " items";
+        if (stored_at.has_value()) {
+            s += ", as listed at " + wxDateTime(*stored_at).FormatISOCombined(' ').ToStdString(wxMBConvUTF8());
         }
+        this->SetStatusText(wxString::FromUTF8(s + ". Checking for changes..."));
+    } else if (in_place) {
+        // Not cached any more, so keep what is shown until the new listing can be compared with it.
+        this->showing_cached_ = true;
+        this->SetStatusText("Checking for changes...");
+    } else {
+        this->current_dir_list_.Clear();
+        this->SortAndPopulateDir();
+        this->SetStatusText("Retrieving directory list...");
+    }
 
-        // Assume sort_column == 0.
-        if (a.name_.length() > 0 && b.name_.length() > 0 && a.name_[0] == '.' &&
-            b.name_[0] != '.') { return true; }
-        if (a.name_.length() > 0 && b.name_.length() > 0 && a.name_[0] != '.' &&
-            b.name_[0] == '.') { return false; }
-        if (this->sort_desc_) {
-            return a.name_ > b.name_;
+    this->listing_in_progress_ = true;
+    this->sftp_thread_channel_->Put(SftpThreadCmdGetDir{remote_path, this->dir_listing_seq_, this->BulkListing()});
+}
+
+// Lists subdirs of the current dir that are not freshly cached, so they can be shown right away when opened. The
+// highlighted one goes first, then the others in the order shown.
+void FileManagerFrame::PrefetchSubdirs() {
+    if (this->busy_cursor_ || this->listing_in_progress_) {
+        return;
+    }
+
+    vector<string> dirs;
+    auto consider = [&](int i) {
+        auto name = this->current_dir_list_.Name(i);
+        if (!this->current_dir_list_.IsDir(i) || name == ".." || dirs.size() >= PREFETCH_MAX_DIRS) {
+            return;
+        }
+        auto path = normalize_path(this->current_dir_ + "/" + string(name));
+        if (find(dirs.begin(), dirs.end(), path) == dirs.end()
+            && !this->dir_cache_.IsFresh(path, seconds(DIR_CACHE_TTL_SECONDS))) {
+            dirs.push_back(path);
         }
-        return a.name_ < b.name_;
     };
-    sort(this->current_dir_list_.begin(), this->current_dir_list_.end(), cmp);
 
+    int highlighted = this->dir_list_ctrl_->GetHighlighted();
+    if (highlighted >= 0 && highlighted < this->current_dir_list_.Count()) {
+        consider(highlighted);
+    }
+    for (int i = 0 ; i < this->current_dir_list_.Count() ; ++i) {
+        consider(i);
+    }
+
+    if (!dirs.empty()) {
+        this->sftp_thread_channel_->Put(SftpThreadCmdPrefetch{dirs, PREFETCH_MAX_ENTRIES});
+    }
+}
+
+void FileManagerFrame::SortAndPopulateDir() {
+    this->SortDirList(&this->current_dir_list_);
     this->dir_list_ctrl_->Refresh(this->current_dir_list_);
 }
 
+// Shows listing, a newer listing of the dir shown, patching only the rows that changed.
+void FileManagerFrame::UpdateDir(DirListingSnapshot listing) {
+    DirListingView view(listing);
+    this->SortDirList(&view);
+    auto diff = diffListings(this->current_dir_list_, view);
+    this->current_dir_list_ = view;  // Even if unchanged, so that sorting again uses the sort keys just worked out.
+    if (diff.Empty()) {
+        return;
+    }
+    this->dir_list_ctrl_->Update(view, diff);
+}
+
+void FileManagerFrame::SortDirList(DirListingView *view) {
+    this->dir_sorter_.Sort(view, this->sort_column_, this->sort_desc_);
+
+    auto filter = this->filter_text_ctrl_->GetValue().ToStdString(wxMBConvUTF8());
+    if (!filter.empty()) {
+        this->name_index_.Build(*view);
+        auto mode = static_cast<NameFilterMode>(this->filter_mode_choice_->GetSelection());
+        view->Filter(this->name_index_.Match(filter, mode));
+    }
+}
+
+void FileManagerFrame::ApplyFilter() {
+    if (!this->current_dir_list_.Empty()) {
+        this->RememberSelected();
+    }
+    this->SortAndPopulateDir();
+    this->RecallSelected();
+
+    // Jump to the first match, so that typing in the filter finds entries even without narrowing the list much.
+    if (!this->filter_text_ctrl_->IsEmpty()) {
+        for (size_t i = 0 ; i < this->current_dir_list_.Count() ; ++i) {
+            if (this->current_dir_list_.Name(i) != "..") {
+                this->dir_list_ctrl_->SetHighlighted(i);
+                break;
+            }
+        }
+    }
+
+    if (!this->listing_in_progress_) {
+        this->SetIdleStatusText();
+    }
+}
+
+void FileManagerFrame::ShowDirTree(bool show) {
+    this->config_->Write("/show_dir_tree", show ? "1" : "0");
+    auto tree = this->dir_tree_ctrl_->GetCtrl();
+    if (show && !this->splitter_->IsSplit()) {
+        tree->Show();
+        this->splitter_->SplitVertically(tree, this->dir_list_ctrl_->GetCtrl(), this->FromDIP(220));
+    } else if (!show && this->splitter_->IsSplit()) {
+        this->splitter_->Unsplit(tree);
+    }
+}
+
+bool FileManagerFrame::CompressTransfers() {
+    return this->config_->Read("/compress_transfers", "0") == "1";
+}
+
+bool FileManagerFrame::BulkListing() {
+    return this->config_->Read("/bulk_listing", "0") == "1";
+}
+
 void FileManagerFrame::DownloadFileForEdit(string remote_path) {
     remote_path = normalize_path(remote_path);
     string local_path = normalize_path(this->local_tmp_ + "/" + remote_path);
@@ -1450,16 +2149,18 @@ void FileManagerFrame::DownloadFileForEdit(string remote_path) {
     // TODO(allan): handle local file creation error separately from a connection errors
     create_directories(localPathUnicode(local_dir));
 
-    this->sftp_thread_channel_->Put(SftpThreadCmdDownload{local_path, remote_path, true});
+    // Files seen as root are not kept around.
+    auto cache = this->sudo_ ? nullptr : this->download_cache_;
+    this->sftp_thread_channel_->Put(SftpThreadCmdDownload{
+            local_path, remote_path, true, this->CompressTransfers(), cache});
     this->SetStatusText(wxString::FromUTF8("Downloading " + remote_path) + " ... Press Esc to cancel.");
     this->busy_cursor_ = make_unique<wxBusyCursor>();
 }
 
 void FileManagerFrame::DownloadFile(string remote_path, string local_path) {
     remote_path = normalize_path(remote_path);
-    this->sftp_thread_channel_->Put(SftpThreadCmdDownload{local_path, remote_path, false});
+    this->StartTransfer(SftpThreadCmdDownload{local_path, remote_path, false, this->CompressTransfers()});
     this->SetStatusText(wxString::FromUTF8("Downloading " + remote_path) + " ... Press Esc to cancel.");
-    this->busy_cursor_ = make_unique<wxBusyCursor>();
 }
 
 bool FileManagerFrame::ValidateFilename(string filename) {
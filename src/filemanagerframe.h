@@ -10,13 +10,16 @@
 #include <wx/aboutdlg.h>
 #include <wx/artprov.h>
 #include <wx/config.h>
+#include <wx/fswatcher.h>
 #include <wx/preferences.h>
+#include <wx/splitter.h>
 #include <wx/stdpaths.h>
 #include <wx/wx.h>
 
 #include <future>  // NOLINT
 #include <map>
 #include <memory>
+#include <optional>
 #include <regex>  // NOLINT
 #include <stack>
 #include <string>
@@ -30,14 +33,23 @@
 #endif
 
 #include "src/channel.h"
+#include "src/dircache.h"
 #include "src/direntry.h"
 #include "src/dirlistctrl.h"
+#include "src/dirlisting.h"
+#include "src/dirsort.h"
+#include "src/dirtreectrl.h"
+#include "src/downloadcache.h"
 #include "src/hostdesc.h"
+#include "src/listingstore.h"
+#include "src/nameindex.h"
 #include "src/sftpthread.h"
+#include "src/transferpool.h"
 
 using std::future;
 using std::make_shared;
 using std::map;
+using std::optional;
 using std::regex;
 using std::regex_search;
 using std::shared_ptr;
@@ -57,6 +69,14 @@ struct OpenedFile {
     string remote_path;
     file_time_type modified;
     bool upload_requested = false;
+    file_time_type uploading;  // The modified time of the version being uploaded.
+    bool upload_superseded = false;  // The upload was cancelled, as a newer version was saved meanwhile.
+    // Size and modified time when last looked at, to tell when the editor is done writing.
+    uint64_t seen_size = 0;
+    file_time_type seen_modified;
+    optional<DirEntry> remote;  // The remote file as last downloaded or uploaded, to tell if someone else changed it.
+    bool remote_changed = false;  // Changed remotely, and the user chose to decide what to do later.
+    optional<uint64_t> hash;  // Content hash of the version on the server, as downloaded or last uploaded.
 };
 
 
@@ -67,27 +87,48 @@ class FileManagerFrame : public wxFrame {
     wxConfigBase *config_;
     wxToolBarBase *tool_bar_;
     wxToolBarToolBase *sudo_btn_;
+    wxSplitterWindow *splitter_;
+    DirTreeCtrl *dir_tree_ctrl_;
     DirListCtrl *dir_list_ctrl_;
     wxTextCtrl *path_text_ctrl_;
-    wxTimer file_watcher_timer_;
+    wxTextCtrl *filter_text_ctrl_;
+    wxChoice *filter_mode_choice_;
+    unique_ptr<wxFileSystemWatcher> file_watcher_;
+    unordered_set<string> watched_dirs_;
+    unordered_set<string> polled_dirs_;  // Dirs of opened files that file_watcher_ could not watch.
+    unordered_set<string> changed_opened_files_;  // Remote paths of opened files to check for changes.
+    wxTimer file_watcher_timer_;  // To check changed_opened_files_ again, while settling or after being busy.
+    wxTimer file_poll_timer_;  // Runs once there are polled_dirs_.
+    wxTimer remote_check_timer_;
+    bool remote_check_pending_ = false;  // Opened files are being stat'ed.
     string home_dir_;
     string current_dir_;
     stack<string> prev_dirs_;
     stack<string> fwd_dirs_;
-    vector<DirEntry> current_dir_list_;
+    DirListingView current_dir_list_;
     int sort_column_ = 0;
     bool sort_desc_ = false;
+    DirListSorter dir_sorter_;
+    NameIndex name_index_;
     map<string, OpenedFile> opened_files_local_;
     string stored_highlighted_ = "";
     unordered_set<string> stored_selected_;
     unique_ptr<future<void>> sftp_thread_;
     shared_ptr<Channel<threadFuncVariant>> sftp_thread_channel_ = make_shared<Channel<threadFuncVariant>>();
     shared_ptr<Channel<bool>> cancellation_channel_ = make_shared<Channel<bool>>();
+    unique_ptr<TransferPool> transfer_pool_;  // For the downloads and uploads the user starts.
+    wxSecretValue sudo_passwd_;  // As entered, to sudo transfer sessions with.
     wxTimer reconnect_timer_;
     int reconnect_timer_countdown_;
     string reconnect_timer_error_ = "";
     string latest_interesting_status_ = "";
     unique_ptr<wxBusyCursor> busy_cursor_;
+    bool listing_in_progress_ = false;  // Listings don't hold busy_cursor_, so entries can be used while they arrive.
+    uint64_t dir_listing_seq_ = 0;
+    DirCache dir_cache_;
+    unique_ptr<ListingStore> listing_store_;
+    shared_ptr<DownloadCache> download_cache_;
+    bool showing_cached_ = false;  // The shown listing came from dir_cache_ and is being listed again.
     bool sudo_ = false;
 
 public:
@@ -110,16 +151,59 @@ private:
 
     void UploadFile(string local_path);
 
+    // Runs a download or upload on the transfer pool, or on the browsing connection if the pool can't be used.
+    void StartTransfer(threadFuncVariant cmd);
+
+    // For the responses that end a command, on whichever connection it ran.
+    void CommandDone(const wxThreadEvent &event);
+
+    // Runs a failed command again on the connection it failed on.
+    void RetryCommand(const wxThreadEvent &event, threadFuncVariant cmd);
+
+    // Watches the dir of an opened file, so that saving it is noticed right away.
+    void WatchOpenedFile(string local_path);
+
+    void OnFileWatcherEvent(wxFileSystemWatcherEvent &event);
+
+    // Uploads the files in changed_opened_files_ that were saved since they were downloaded or last uploaded, once
+    // they have stopped changing. An upload of an older version still in progress is cancelled.
+    void CheckChangedOpenedFiles();
+
     void OnFileWatcherTimer(const wxTimerEvent &event);
 
+    void OnFilePollTimer(const wxTimerEvent &event);
+
+    // Stats the opened files, to find those changed remotely since downloaded or last uploaded.
+    void OnRemoteCheckTimer(const wxTimerEvent &event);
+
+    // Asks whether to reload, overwrite or merge an opened file that someone else changed remotely.
+    void ResolveRemoteChange(string remote_path, DirEntry remote);
+
     void RememberSelected();
 
     void RecallSelected();
 
-    void RefreshDir(string remote_path, bool preserve_selection);
+    // Shows the listing of remote_path, from the cache if there, and lists it again unless the cache is fresh enough.
+    void RefreshDir(string remote_path, bool preserve_selection, bool force = false);
 
     void SortAndPopulateDir();
 
+    void UpdateDir(DirListingSnapshot listing);
+
+    // Sorts view by the column chosen, and drops the rows that don't match the filter field.
+    void SortDirList(DirListingView *view);
+
+    void ShowDirTree(bool show);
+
+    // Narrows the list to the entries matching the filter field, and highlights the first of them.
+    void ApplyFilter();
+
+    void PrefetchSubdirs();
+
+    bool CompressTransfers();
+
+    bool BulkListing();
+
     void DownloadFileForEdit(string remote_path);
 
     void DownloadFile(string remote_path, string local_path);
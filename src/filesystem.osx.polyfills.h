@@ -43,6 +43,12 @@ static file_time_type last_write_time(string path) {
     return attr.st_mtime;
 }
 
+static uint64_t file_size(string path) {
+    struct stat attr;
+    stat(path.c_str(), &attr);
+    return attr.st_size;
+}
+
 static void remove(string path) {
     remove(path.c_str());
 }
@@ -0,0 +1,140 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/filetypes.h"
+
+#include <array>
+#include <string>
+#include <string_view>
+
+using std::array;
+using std::size;
+using std::string;
+using std::string_view;
+
+// Suffixes longer than this are not looked for in the built in table.
+#define MAX_SUFFIX_LEN 8
+#define SUFFIX_TABLE_SIZE 64
+// Chosen so that no two built in suffixes hash to the same slot, which is checked below.
+#define SUFFIX_HASH_SEED 2166136269u
+
+struct SuffixType {
+    string_view suffix;
+    FileType type;
+};
+
+static constexpr SuffixType SUFFIXES[] = {
+        {"jpeg", FILE_TYPE_PICTURE},
+        {"jpg", FILE_TYPE_PICTURE},
+        {"png", FILE_TYPE_PICTURE},
+        {"gif", FILE_TYPE_PICTURE},
+        {"webp", FILE_TYPE_PICTURE},
+        {"bmp", FILE_TYPE_PICTURE},
+        {"psd", FILE_TYPE_PICTURE},
+        {"ai", FILE_TYPE_PICTURE},
+        {"svg", FILE_TYPE_PICTURE},
+        {"eps", FILE_TYPE_PICTURE},
+        {"tif", FILE_TYPE_PICTURE},
+        {"tiff", FILE_TYPE_PICTURE},
+        {"tar", FILE_TYPE_ARCHIVE},
+        {"tgz", FILE_TYPE_ARCHIVE},
+        {"gz", FILE_TYPE_ARCHIVE},
+        {"bz2", FILE_TYPE_ARCHIVE},
+        {"7z", FILE_TYPE_ARCHIVE},
+        {"xz", FILE_TYPE_ARCHIVE},
+        {"zip", FILE_TYPE_ARCHIVE},
+};
+
+// FNV-1a, with the seed in place of the usual offset basis.
+static constexpr size_t suffixSlot(string_view suffix) {
+    uint32_t h = SUFFIX_HASH_SEED;
+    for (char c : suffix) {
+        h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return h % SUFFIX_TABLE_SIZE;
+}
+
+// The index into SUFFIXES for each slot, or -1 for none.
+static constexpr array<int8_t, SUFFIX_TABLE_SIZE> suffixSlots() {
+    array<int8_t, SUFFIX_TABLE_SIZE> slots{};
+    for (auto &slot : slots) {
+        slot = -1;
+    }
+    for (size_t i = 0 ; i < size(SUFFIXES) ; ++i) {
+        slots[suffixSlot(SUFFIXES[i].suffix)] = i;
+    }
+    return slots;
+}
+
+static constexpr auto SUFFIX_SLOTS = suffixSlots();
+
+static constexpr bool suffixSlotsArePerfect() {
+    for (size_t i = 0 ; i < size(SUFFIXES) ; ++i) {
+        if (SUFFIX_SLOTS[suffixSlot(SUFFIXES[i].suffix)] != static_cast<int8_t>(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(suffixSlotsArePerfect(), "Built in suffixes share a slot, try another SUFFIX_HASH_SEED");
+
+static char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static string lowered(string_view s) {
+    string r(s);
+    for (auto &c : r) {
+        c = toLower(c);
+    }
+    return r;
+}
+
+void FileTypes::Add(string_view suffixes, FileType type) {
+    size_t i = 0;
+    while (i < suffixes.size()) {
+        size_t start = suffixes.find_first_not_of(" ,;.", i);
+        if (start == string_view::npos) {
+            break;
+        }
+        size_t end = suffixes.find_first_of(" ,;", start);
+        if (end == string_view::npos) {
+            end = suffixes.size();
+        }
+        this->added_[lowered(suffixes.substr(start, end - start))] = type;
+        i = end;
+    }
+}
+
+void FileTypes::Clear() {
+    this->added_.clear();
+}
+
+FileType FileTypes::Of(string_view name) const {
+    size_t dot = name.rfind('.');
+    if (dot == string_view::npos) {
+        return FILE_TYPE_OTHER;
+    }
+    auto suffix = name.substr(dot + 1);
+
+    if (suffix.size() <= MAX_SUFFIX_LEN) {
+        char buf[MAX_SUFFIX_LEN];
+        for (size_t i = 0 ; i < suffix.size() ; ++i) {
+            buf[i] = toLower(suffix[i]);
+        }
+        string_view key(buf, suffix.size());
+        auto i = SUFFIX_SLOTS[suffixSlot(key)];
+        if (i >= 0 && SUFFIXES[i].suffix == key) {
+            return SUFFIXES[i].type;
+        }
+    }
+
+    if (this->added_.empty()) {
+        return FILE_TYPE_OTHER;
+    }
+    auto it = this->added_.find(lowered(suffix));
+    if (it == this->added_.end()) {
+        return FILE_TYPE_OTHER;
+    }
+    return it->second;
+}
@@ -0,0 +1,36 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_FILETYPES_H_
+#define SRC_FILETYPES_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using std::string;
+using std::string_view;
+using std::unordered_map;
+
+enum FileType {
+    FILE_TYPE_OTHER,
+    FILE_TYPE_PICTURE,
+    FILE_TYPE_ARCHIVE,
+};
+
+// Tells pictures, archives and other files apart by the suffix of their names, ignoring case. The built in suffixes
+// are in a perfect hash table made at compile time, so classifying a name costs hashing its suffix and at most one
+// comparison. More suffixes can be added, such as from preferences.
+class FileTypes {
+private:
+    unordered_map<string, FileType> added_;
+
+public:
+    // Adds suffixes to type, given as a list such as ".heic, raw cr2".
+    void Add(string_view suffixes, FileType type);
+
+    void Clear();
+
+    FileType Of(string_view name) const;
+};
+
+#endif  // SRC_FILETYPES_H_
@@ -0,0 +1,133 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/findlisting.h"
+
+#include <libssh2_sftp.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/string.h"
+
+using std::string;
+using std::string_view;
+
+// Type, type with symlinks followed, permissions, size, mtime, uid, gid, owner, group and name. Owner and group fall
+// back to the numeric ids when they have no name.
+#define FIND_LISTING_FORMAT "'%y\\0%Y\\0%m\\0%s\\0%T@\\0%U\\0%G\\0%u\\0%g\\0%f\\0'"
+#define FIND_LISTING_FIELDS 10
+
+string findListingCommand(string path) {
+    return "find " + shellQuote(path + "/..") + " -maxdepth 0 -printf " FIND_LISTING_FORMAT
+           + " && find " + shellQuote(path) + " -mindepth 1 -maxdepth 1 -printf " FIND_LISTING_FORMAT;
+}
+
+string findSubdirsCommand(string path) {
+    return "find " + shellQuote(path) + " -mindepth 1 -maxdepth 1 -xtype d -printf " FIND_LISTING_FORMAT;
+}
+
+// Parses leading digits in the given base, ignoring anything after them, such as the fraction of "%T@".
+static uint64_t parseNumber(string_view s, int base) {
+    uint64_t v = 0;
+    for (char c : s) {
+        if (c < '0' || c >= '0' + base) {
+            break;
+        }
+        v = v * base + (c - '0');
+    }
+    return v;
+}
+
+static uint64_t fileTypeBits(string_view type) {
+    switch (type.empty() ? '\0' : type[0]) {
+        case 'd':
+            return LIBSSH2_SFTP_S_IFDIR;
+        case 'l':
+            return LIBSSH2_SFTP_S_IFLNK;
+        case 'p':
+            return LIBSSH2_SFTP_S_IFIFO;
+        case 's':
+            return LIBSSH2_SFTP_S_IFSOCK;
+        case 'c':
+            return LIBSSH2_SFTP_S_IFCHR;
+        case 'b':
+            return LIBSSH2_SFTP_S_IFBLK;
+        default:
+            return LIBSSH2_SFTP_S_IFREG;
+    }
+}
+
+// Returns the length of the complete record at the start of data, or 0 if it is cut off. Fills in fields if complete.
+static size_t splitRecord(string_view data, string_view fields[FIND_LISTING_FIELDS]) {
+    const char *p = data.data();
+    const char *end = data.data() + data.size();
+    for (int i = 0 ; i < FIND_LISTING_FIELDS ; ++i) {
+        auto nul = static_cast<const char *>(memchr(p, '\0', end - p));
+        if (!nul) {
+            return 0;
+        }
+        fields[i] = string_view(p, nul - p);
+        p = nul + 1;
+    }
+    return p - data.data();
+}
+
+static DirEntry makeEntry(const string_view fields[FIND_LISTING_FIELDS]) {
+    DirEntry d;
+    d.mode_ = fileTypeBits(fields[0]) | parseNumber(fields[2], 8);
+    d.is_dir_ = LIBSSH2_SFTP_S_ISDIR(fileTypeBits(fields[1]));  // Symlinks to dirs count as dirs.
+    d.size_ = parseNumber(fields[3], 10);
+    d.modified_ = parseNumber(fields[4], 10);
+    d.uid_ = parseNumber(fields[5], 10);
+    d.gid_ = parseNumber(fields[6], 10);
+    d.owner_ = string(fields[7]);
+    d.group_ = string(fields[8]);
+    d.name_ = string(fields[9]);
+    return d;
+}
+
+void FindListingParser::Feed(string_view data, DirListing *entries) {
+    string_view fields[FIND_LISTING_FIELDS];
+
+    if (!this->pending_.empty()) {
+        // Copy only up to the end of the cut off record.
+        size_t i = 0;
+        while (i < data.size() && this->pending_fields_ < FIND_LISTING_FIELDS) {
+            if (data[i++] == '\0') {
+                this->pending_fields_++;
+            }
+        }
+        this->pending_.append(data.data(), i);
+        data.remove_prefix(i);
+        if (this->pending_fields_ < FIND_LISTING_FIELDS) {
+            return;
+        }
+
+        splitRecord(this->pending_, fields);
+        entries->Add(makeEntry(fields));
+        this->pending_.clear();
+        this->pending_fields_ = 0;
+    }
+
+    while (!data.empty()) {
+        size_t len = splitRecord(data, fields);
+        if (len == 0) {
+            this->pending_ = string(data);
+            for (char c : data) {
+                if (c == '\0') {
+                    this->pending_fields_++;
+                }
+            }
+            return;
+        }
+        entries->Add(makeEntry(fields));
+        data.remove_prefix(len);
+    }
+}
+
+bool FindListingParser::AtRecordBoundary() {
+    return this->pending_.empty();
+}
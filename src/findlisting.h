@@ -0,0 +1,37 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_FINDLISTING_H_
+#define SRC_FINDLISTING_H_
+
+#include <string>
+#include <string_view>
+
+#include "src/dirlisting.h"
+
+using std::string;
+using std::string_view;
+
+// A shell command listing path, including "..", with GNU find. The output is NUL-delimited records for
+// FindListingParser, so names with any characters in them come through unharmed.
+string findListingCommand(string path);
+
+// Like findListingCommand, but only the subdirs of path, including symlinks to dirs, and without "..".
+string findSubdirsCommand(string path);
+
+// Turns the output of findListingCommand into directory entries, as it arrives in chunks cut at arbitrary places.
+// Fields are parsed straight out of the chunks. Only a record cut off at the end of a chunk is copied, to be completed
+// by the next one.
+class FindListingParser {
+private:
+    string pending_;
+    size_t pending_fields_ = 0;
+
+public:
+    // Appends the records completed by data to entries.
+    void Feed(string_view data, DirListing *entries);
+
+    // True if the output fed so far ended with a complete record.
+    bool AtRecordBoundary();
+};
+
+#endif  // SRC_FINDLISTING_H_
@@ -0,0 +1,112 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/gzipstream.h"
+
+#include <zlib.h>
+
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+using std::function;
+using std::runtime_error;
+using std::string;
+
+#define GZIP_WINDOW_BITS (16 + MAX_WBITS)  // The +16 makes zlib read and write gzip headers instead of zlib headers.
+#define INFLATE_BUFLEN 65536
+
+GzipInflater::GzipInflater() {
+    memset(&this->zs_, 0, sizeof(this->zs_));
+    if (inflateInit2(&this->zs_, GZIP_WINDOW_BITS) != Z_OK) {
+        throw runtime_error("inflateInit2 failed");
+    }
+}
+
+GzipInflater::~GzipInflater() {
+    inflateEnd(&this->zs_);
+}
+
+bool GzipInflater::Write(const char *data, size_t len, function<void(const char *, size_t)> sink) {
+    if (!this->ok_) {
+        return false;
+    }
+
+    char out[INFLATE_BUFLEN];
+    this->zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    this->zs_.avail_in = len;
+    while (this->zs_.avail_in > 0) {
+        if (this->at_member_end_) {
+            // Another gzip member follows the one that just ended.
+            inflateReset(&this->zs_);
+            this->at_member_end_ = false;
+        }
+
+        this->zs_.next_out = reinterpret_cast<Bytef *>(out);
+        this->zs_.avail_out = INFLATE_BUFLEN;
+        int rc = inflate(&this->zs_, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            this->ok_ = false;
+            return false;
+        }
+
+        size_t n = INFLATE_BUFLEN - this->zs_.avail_out;
+        if (n > 0) {
+            sink(out, n);
+        }
+
+        if (rc == Z_STREAM_END) {
+            this->at_member_end_ = true;
+        } else if (n == 0 && this->zs_.avail_in > 0) {
+            // No progress although there is input left. Should not happen for a well-formed stream.
+            this->ok_ = false;
+            return false;
+        }
+    }
+
+    // Drain anything zlib still holds back from this input.
+    while (!this->at_member_end_) {
+        this->zs_.next_out = reinterpret_cast<Bytef *>(out);
+        this->zs_.avail_out = INFLATE_BUFLEN;
+        int rc = inflate(&this->zs_, Z_NO_FLUSH);
+        size_t n = INFLATE_BUFLEN - this->zs_.avail_out;
+        if (n > 0) {
+            sink(out, n);
+        }
+        if (rc == Z_STREAM_END) {
+            this->at_member_end_ = true;
+        }
+        if (n == 0 || (rc != Z_OK && rc != Z_STREAM_END)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool GzipInflater::Finished() {
+    return this->ok_ && this->at_member_end_;
+}
+
+string gzipCompressMember(const char *data, size_t len, int level) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("deflateInit2 failed");
+    }
+
+    string out;
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = len;
+    zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    zs.avail_out = out.size();
+    int rc = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END) {
+        throw runtime_error("deflate failed");
+    }
+
+    out.resize(zs.total_out);
+    return out;
+}
@@ -0,0 +1,42 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_GZIPSTREAM_H_
+#define SRC_GZIPSTREAM_H_
+
+#include <zlib.h>
+
+#include <functional>
+#include <string>
+
+using std::function;
+using std::string;
+
+// Incrementally decompresses a gzip stream, such as the output of "gzip -c" on the remote. Concatenated gzip members
+// are handled, as that is what gzipCompressMember produces.
+class GzipInflater {
+private:
+    z_stream zs_;
+    bool ok_ = true;
+    bool at_member_end_ = false;
+
+public:
+    GzipInflater();
+
+    ~GzipInflater();
+
+    GzipInflater(const GzipInflater &) = delete;
+
+    GzipInflater &operator=(const GzipInflater &) = delete;
+
+    // Feeds compressed bytes. Decompressed bytes are passed to sink. Returns false if the stream is corrupt.
+    bool Write(const char *data, size_t len, function<void(const char *, size_t)> sink);
+
+    // True if the input so far ended exactly at the end of a gzip member.
+    bool Finished();
+};
+
+// Compresses a block into a self-contained gzip member. Members can be compressed independently on separate threads
+// and concatenated, and "gzip -d" will decompress the concatenation as one stream.
+string gzipCompressMember(const char *data, size_t len, int level);
+
+#endif  // SRC_GZIPSTREAM_H_
@@ -14,6 +14,8 @@
 #define ID_MKDIR 90
 #define ID_SUDO 100
 #define ID_START_NEW_INSTANCE 110
+#define ID_FILTER 120
+#define ID_SHOW_DIR_TREE 130
 
 #define ID_SFTP_THREAD_RESPONSE_CONNECTED 510
 #define ID_SFTP_THREAD_RESPONSE_GET_DIR 520
@@ -44,6 +46,13 @@
 #define ID_SFTP_THREAD_RESPONSE_SUDO_EXIT_SUCCEEDED 770
 #define ID_SFTP_THREAD_RESPONSE_UPLOAD_PROGRESS 780
 #define ID_SFTP_THREAD_RESPONSE_DOWNLOAD_PROGRESS 790
+#define ID_SFTP_THREAD_RESPONSE_GET_DIR_PARTIAL 800
+#define ID_SFTP_THREAD_RESPONSE_PREFETCHED 810
+#define ID_SFTP_THREAD_RESPONSE_SUBDIRS 820
+#define ID_SFTP_THREAD_RESPONSE_STAT_OPENED 830
+#define ID_SFTP_THREAD_RESPONSE_REMOTE_CHANGED 840
+#define ID_SFTP_THREAD_RESPONSE_UPLOAD_UNCHANGED 850
+#define ID_SFTP_THREAD_RESPONSE_POOL_CONNECTED 860
 
 
 #endif  // SRC_IDS_H_
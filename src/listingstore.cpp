@@ -0,0 +1,372 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/listingstore.h"
+
+#ifndef __WXMSW__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "src/dircache.h"
+#include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/string.h"
+
+using std::greater;
+using std::nullopt;
+using std::optional;
+using std::pair;
+using std::sort;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+
+#define LISTING_STORE_MAGIC 0x4c524746  // Also rejects files written with the other byte order.
+#define LISTING_STORE_VERSION 1
+
+struct StoreHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_dirs;
+    uint32_t num_entries;
+    uint64_t strings_len;
+};
+
+struct StoreDir {
+    int64_t fetched;
+    uint32_t path_off;
+    uint32_t path_len;
+    uint32_t first_entry;
+    uint32_t num_entries;
+};
+
+struct StoreEntry {
+    uint64_t size;
+    uint64_t modified;
+    uint64_t mode;
+    uint64_t uid;
+    uint64_t gid;
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t mode_str_off;
+    uint32_t mode_str_len;
+    uint32_t owner_off;
+    uint32_t owner_len;
+    uint32_t group_off;
+    uint32_t group_len;
+    uint8_t is_dir;
+    uint8_t padding[7];
+};
+
+// Builds the string table of a store file. Owner, group and mode strings repeat a lot, so those are deduplicated.
+class StringTableWriter {
+    unordered_map<string, uint32_t> dedup_;
+
+public:
+    string buf_;
+
+    pair<uint32_t, uint32_t> Add(string_view s) {
+        uint32_t off = this->buf_.size();
+        this->buf_.append(s.data(), s.size());
+        return {off, s.size()};
+    }
+
+    pair<uint32_t, uint32_t> AddShared(const string &s) {
+        auto it = this->dedup_.find(s);
+        if (it != this->dedup_.end()) {
+            return {it->second, s.size()};
+        }
+        auto r = this->Add(s);
+        this->dedup_[s] = r.first;
+        return r;
+    }
+};
+
+template<typename T>
+static void appendRecord(string *buf, const T &record) {
+    buf->append(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+ListingStore::ListingStore(string file_path) : file_path_(file_path) {
+    this->Map();
+}
+
+ListingStore::~ListingStore() {
+    this->Unmap();
+}
+
+optional<StoredListing> ListingStore::Get(const string &path) {
+    auto it = this->dir_index_.find(path);
+    if (it == this->dir_index_.end()) {
+        return nullopt;
+    }
+
+    StoreHeader header;
+    memcpy(&header, this->data_, sizeof(header));
+    const char *entries = this->data_ + sizeof(StoreHeader) + header.num_dirs * sizeof(StoreDir);
+    const char *strings = entries + header.num_entries * sizeof(StoreEntry);
+
+    StoreDir dir;
+    memcpy(&dir, this->data_ + sizeof(StoreHeader) + it->second * sizeof(StoreDir), sizeof(dir));
+
+    StoredListing r;
+    r.fetched = dir.fetched;
+    for (uint32_t i = dir.first_entry ; i < dir.first_entry + dir.num_entries ; ++i) {
+        StoreEntry e;
+        memcpy(&e, entries + i * sizeof(StoreEntry), sizeof(e));
+
+        DirEntry d;
+        d.name_ = string(strings + e.name_off, e.name_len);
+        d.size_ = e.size;
+        d.modified_ = e.modified;
+        d.mode_ = e.mode;
+        d.mode_str_ = string(strings + e.mode_str_off, e.mode_str_len);
+        d.uid_ = e.uid;
+        d.gid_ = e.gid;
+        d.owner_ = string(strings + e.owner_off, e.owner_len);
+        d.group_ = string(strings + e.group_off, e.group_len);
+        d.is_dir_ = e.is_dir;
+        r.entries.Add(d);
+    }
+    return r;
+}
+
+void ListingStore::Save(const DirCache &cache, size_t max_entries) {
+    string dirs;
+    string entries;
+    StringTableWriter strings;
+    unordered_set<string> written;
+    uint32_t num_dirs = 0;
+    uint32_t num_entries = 0;
+
+    // Returns false if the listing didn't fit.
+    auto add_listing = [&](const string &path, const DirListing &listing, time_t fetched) {
+        if (written.count(path)) {
+            return true;
+        }
+        if (num_entries + listing.Count() > max_entries) {
+            return false;
+        }
+        written.insert(path);
+
+        StoreDir dir;
+        memset(&dir, 0, sizeof(dir));
+        dir.fetched = fetched;
+        auto p = strings.Add(path);
+        dir.path_off = p.first;
+        dir.path_len = p.second;
+        dir.first_entry = num_entries;
+        dir.num_entries = listing.Count();
+        appendRecord(&dirs, dir);
+        num_dirs++;
+
+        for (size_t i = 0 ; i < listing.Count() ; ++i) {
+            StoreEntry e;
+            memset(&e, 0, sizeof(e));
+            e.size = listing.FileSize(i);
+            e.modified = listing.Modified(i);
+            e.mode = listing.Mode(i);
+            e.uid = listing.Uid(i);
+            e.gid = listing.Gid(i);
+            auto name = strings.Add(listing.Name(i));
+            e.name_off = name.first;
+            e.name_len = name.second;
+            auto mode_str = strings.AddShared(listing.ModeString(i));
+            e.mode_str_off = mode_str.first;
+            e.mode_str_len = mode_str.second;
+            auto owner = strings.AddShared(string(listing.Owner(i)));
+            e.owner_off = owner.first;
+            e.owner_len = owner.second;
+            auto group = strings.AddShared(string(listing.Group(i)));
+            e.group_off = group.first;
+            e.group_len = group.second;
+            e.is_dir = listing.IsDir(i);
+            appendRecord(&entries, e);
+            num_entries++;
+        }
+        return true;
+    };
+
+    auto steady_now = steady_clock::now();
+    auto system_now = system_clock::now();
+    cache.ForEach([&](const string &path, const DirListing &listing, steady_clock::time_point fetched) {
+        auto age = duration_cast<system_clock::duration>(steady_now - fetched);
+        add_listing(path, listing, system_clock::to_time_t(system_now - age));
+    });
+
+    // Keep listings from earlier runs that were not visited this time, the most recently fetched first.
+    vector<pair<time_t, string>> stored_paths;
+    for (auto &it : this->dir_index_) {
+        StoreDir dir;
+        memcpy(&dir, this->data_ + sizeof(StoreHeader) + it.second * sizeof(StoreDir), sizeof(dir));
+        stored_paths.emplace_back(dir.fetched, it.first);
+    }
+    sort(stored_paths.begin(), stored_paths.end(), greater<pair<time_t, string>>());
+    for (auto &[fetched, path] : stored_paths) {
+        if (written.count(path)) {
+            continue;
+        }
+        auto stored = this->Get(path);
+        if (!add_listing(path, stored->entries, stored->fetched)) {
+            break;  // Older ones are not kept ahead of this one.
+        }
+    }
+
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = LISTING_STORE_MAGIC;
+    header.version = LISTING_STORE_VERSION;
+    header.num_dirs = num_dirs;
+    header.num_entries = num_entries;
+    header.strings_len = strings.buf_.size();
+
+    // The mapping has to go before the file can be replaced, at least on Windows.
+    this->Unmap();
+
+    string tmp_path = this->file_path_ + ".tmp";
+#ifdef __WXMSW__
+    FILE *f = _wfopen(localPathUnicode(tmp_path).c_str(), L"wb");
+#else
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+#endif
+    if (!f) {
+        // Not being able to store listings for next time is not worth bothering the user about.
+        this->Map();
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(dirs.data(), 1, dirs.size(), f) == dirs.size();
+    ok = ok && fwrite(entries.data(), 1, entries.size(), f) == entries.size();
+    ok = ok && fwrite(strings.buf_.data(), 1, strings.buf_.size(), f) == strings.buf_.size();
+    ok = fclose(f) == 0 && ok;
+
+#ifdef __WXMSW__
+    if (ok) {
+        _wremove(localPathUnicode(this->file_path_).c_str());
+        ok = _wrename(localPathUnicode(tmp_path).c_str(), localPathUnicode(this->file_path_).c_str()) == 0;
+    }
+    if (!ok) {
+        _wremove(localPathUnicode(tmp_path).c_str());
+    }
+#else
+    if (ok) {
+        ok = rename(tmp_path.c_str(), this->file_path_.c_str()) == 0;
+    }
+    if (!ok) {
+        remove(tmp_path.c_str());
+    }
+#endif
+
+    this->Map();
+}
+
+void ListingStore::Map() {
+#ifdef __WXMSW__
+    FILE *f = _wfopen(localPathUnicode(this->file_path_).c_str(), L"rb");
+    if (!f) {
+        return;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        this->buf_.append(buf, n);
+    }
+    fclose(f);
+    this->data_ = this->buf_.data();
+    this->size_ = this->buf_.size();
+#else
+    int fd = open(this->file_path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < static_cast<off_t>(sizeof(StoreHeader))) {
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    this->data_ = static_cast<const char *>(p);
+    this->size_ = sb.st_size;
+#endif
+
+    // Validate everything up front, so Get can trust the offsets.
+    StoreHeader header;
+    if (this->size_ < sizeof(header)) {
+        this->Unmap();
+        return;
+    }
+    memcpy(&header, this->data_, sizeof(header));
+    uint64_t expected_size = sizeof(StoreHeader) + uint64_t(header.num_dirs) * sizeof(StoreDir)
+                             + uint64_t(header.num_entries) * sizeof(StoreEntry) + header.strings_len;
+    if (header.magic != LISTING_STORE_MAGIC || header.version != LISTING_STORE_VERSION
+        || expected_size != this->size_) {
+        this->Unmap();
+        return;
+    }
+
+    const char *dirs = this->data_ + sizeof(StoreHeader);
+    const char *entries = dirs + header.num_dirs * sizeof(StoreDir);
+    const char *strings = entries + header.num_entries * sizeof(StoreEntry);
+    auto string_ok = [&](uint32_t off, uint32_t len) {
+        return uint64_t(off) + len <= header.strings_len;
+    };
+
+    for (uint32_t i = 0 ; i < header.num_entries ; ++i) {
+        StoreEntry e;
+        memcpy(&e, entries + i * sizeof(StoreEntry), sizeof(e));
+        if (!string_ok(e.name_off, e.name_len) || !string_ok(e.mode_str_off, e.mode_str_len)
+            || !string_ok(e.owner_off, e.owner_len) || !string_ok(e.group_off, e.group_len)) {
+            this->Unmap();
+            return;
+        }
+    }
+
+    for (uint32_t i = 0 ; i < header.num_dirs ; ++i) {
+        StoreDir dir;
+        memcpy(&dir, dirs + i * sizeof(StoreDir), sizeof(dir));
+        if (!string_ok(dir.path_off, dir.path_len)
+            || uint64_t(dir.first_entry) + dir.num_entries > header.num_entries) {
+            this->Unmap();
+            return;
+        }
+        this->dir_index_[string(strings + dir.path_off, dir.path_len)] = i;
+    }
+}
+
+void ListingStore::Unmap() {
+    this->dir_index_.clear();
+#ifdef __WXMSW__
+    this->buf_.clear();
+    this->buf_.shrink_to_fit();
+#else
+    if (this->data_) {
+        munmap(const_cast<char *>(this->data_), this->size_);
+    }
+#endif
+    this->data_ = NULL;
+    this->size_ = 0;
+}
@@ -0,0 +1,61 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_LISTINGSTORE_H_
+#define SRC_LISTINGSTORE_H_
+
+#include <ctime>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "src/dircache.h"
+#include "src/direntry.h"
+#include "src/dirlisting.h"
+
+using std::optional;
+using std::string;
+using std::unordered_map;
+
+struct StoredListing {
+    DirListing entries;
+    time_t fetched;
+};
+
+// A file with the recently visited directory listings of one host, kept between runs so they can be shown right away
+// after connecting, while they are listed again.
+//
+// The file is a header, a table of dirs, a table of fixed size entry records, and a string table that the records
+// point into, all in native byte order. It is memory mapped where possible, and only the entries of a dir that is
+// asked for are decoded.
+class ListingStore {
+private:
+    string file_path_;
+    const char *data_ = NULL;
+    size_t size_ = 0;
+#ifdef __WXMSW__
+    string buf_;
+#endif
+    unordered_map<string, uint32_t> dir_index_;
+
+public:
+    explicit ListingStore(string file_path);
+
+    ~ListingStore();
+
+    ListingStore(const ListingStore &) = delete;
+
+    ListingStore &operator=(const ListingStore &) = delete;
+
+    optional<StoredListing> Get(const string &path);
+
+    // Replaces the file with the listings in cache, followed by previously stored ones not in cache, the most recently
+    // fetched first, until max_entries entries in total.
+    void Save(const DirCache &cache, size_t max_entries);
+
+private:
+    void Map();
+
+    void Unmap();
+};
+
+#endif  // SRC_LISTINGSTORE_H_
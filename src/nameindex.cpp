@@ -0,0 +1,276 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/nameindex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/dirlisting.h"
+
+using std::back_inserter;
+using std::set_intersection;
+using std::sort;
+using std::string;
+using std::string_view;
+using std::unique;
+using std::vector;
+
+// Trigrams are hashed into this many buckets. Entries in a bucket only share a hash, so candidates are always checked.
+#define TRIGRAM_BUCKETS 65536
+
+static char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static uint32_t trigramBucket(const char *p) {
+    uint32_t t = static_cast<uint8_t>(p[0]) << 16 | static_cast<uint8_t>(p[1]) << 8 | static_cast<uint8_t>(p[2]);
+    return (t * 2654435761u) >> 16;
+}
+
+static uint64_t charMask(string_view s) {
+    uint64_t mask = 0;
+    for (char c : s) {
+        mask |= uint64_t(1) << (static_cast<uint8_t>(c) & 63);
+    }
+    return mask;
+}
+
+// Matches the whole of name against pattern, where * is any run of characters, ? any one, and [...] any one of those
+// listed, including ranges such as a-z, or any not listed if it starts with !.
+static bool globMatch(string_view name, string_view pattern) {
+    size_t n = 0;
+    size_t p = 0;
+    size_t star_p = string_view::npos;
+    size_t star_n = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star_p = p++;
+            star_n = n;
+            continue;
+        }
+
+        bool matched = false;
+        size_t next_p = p + 1;
+        if (p < pattern.size() && pattern[p] == '[') {
+            size_t i = p + 1;
+            bool negate = i < pattern.size() && pattern[i] == '!';
+            if (negate) {
+                i++;
+            }
+            bool in_class = false;
+            size_t first = i;
+            while (i < pattern.size() && (pattern[i] != ']' || i == first)) {
+                if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    in_class |= pattern[i] <= name[n] && name[n] <= pattern[i + 2];
+                    i += 3;
+                } else {
+                    in_class |= pattern[i] == name[n];
+                    i++;
+                }
+            }
+            if (i < pattern.size()) {
+                matched = in_class != negate;
+                next_p = i + 1;
+            } else {
+                matched = name[n] == '[';  // No closing bracket, so a plain [.
+            }
+        } else if (p < pattern.size()) {
+            matched = pattern[p] == '?' || pattern[p] == name[n];
+        }
+
+        if (matched) {
+            p = next_p;
+            n++;
+        } else if (star_p != string_view::npos) {
+            p = star_p + 1;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+static bool fuzzyMatch(string_view name, string_view query) {
+    size_t n = 0;
+    for (char c : query) {
+        n = name.find(c, n);
+        if (n == string_view::npos) {
+            return false;
+        }
+        n++;
+    }
+    return true;
+}
+
+// The longest run of pattern that any match has to contain as is.
+static string_view globLiteral(string_view pattern) {
+    string_view longest;
+    size_t start = 0;
+    for (size_t i = 0 ; i <= pattern.size() ; ++i) {
+        if (i < pattern.size() && pattern[i] != '*' && pattern[i] != '?' && pattern[i] != '[') {
+            continue;
+        }
+        if (i - start > longest.size()) {
+            longest = pattern.substr(start, i - start);
+        }
+        if (i < pattern.size() && pattern[i] == '[') {
+            i = pattern.find(']', i + 2);
+            if (i == string_view::npos) {
+                break;
+            }
+        }
+        start = i + 1;
+    }
+    return longest;
+}
+
+string_view NameIndex::Name(size_t i) const {
+    return string_view(this->names_).substr(this->name_starts_[i], this->name_starts_[i + 1] - this->name_starts_[i]);
+}
+
+void NameIndex::Build(const DirListingView &view) {
+    if (this->built_ && this->source_.SameParts(view)) {
+        return;
+    }
+    this->built_ = true;
+    this->source_ = view.Unordered();
+    auto &l = this->source_;
+    size_t n = l.Count();
+
+    this->names_.clear();
+    this->name_starts_.assign(1, 0);
+    this->name_starts_.reserve(n + 1);
+    this->char_masks_.resize(n);
+    this->parent_dir_ = -1;
+    for (size_t i = 0 ; i < n ; ++i) {
+        auto name = l.Name(i);
+        if (name == "..") {
+            this->parent_dir_ = i;
+        }
+        for (char c : name) {
+            this->names_.push_back(toLower(c));
+        }
+        this->name_starts_.push_back(this->names_.size());
+        this->char_masks_[i] = charMask(this->Name(i));
+    }
+
+    // Count the entries in each bucket first, so that all can go in one array. Entries are added in order, so each
+    // bucket ends up sorted, and an entry with a trigram twice is only added once.
+    vector<uint32_t> last(TRIGRAM_BUCKETS, UINT32_MAX);
+    this->bucket_starts_.assign(TRIGRAM_BUCKETS + 1, 0);
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        auto name = this->Name(i);
+        for (size_t j = 0 ; j + 3 <= name.size() ; ++j) {
+            auto b = trigramBucket(name.data() + j);
+            if (last[b] != i) {
+                last[b] = i;
+                this->bucket_starts_[b + 1]++;
+            }
+        }
+    }
+    for (size_t b = 0 ; b < TRIGRAM_BUCKETS ; ++b) {
+        this->bucket_starts_[b + 1] += this->bucket_starts_[b];
+    }
+
+    this->postings_.resize(this->bucket_starts_[TRIGRAM_BUCKETS]);
+    vector<uint32_t> next(this->bucket_starts_.begin(), this->bucket_starts_.end() - 1);
+    last.assign(TRIGRAM_BUCKETS, UINT32_MAX);
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        auto name = this->Name(i);
+        for (size_t j = 0 ; j + 3 <= name.size() ; ++j) {
+            auto b = trigramBucket(name.data() + j);
+            if (last[b] != i) {
+                last[b] = i;
+                this->postings_[next[b]++] = i;
+            }
+        }
+    }
+}
+
+// The entries that may contain literal, which is at least three characters long.
+vector<uint32_t> NameIndex::Candidates(string_view literal) const {
+    vector<uint32_t> buckets;
+    for (size_t j = 0 ; j + 3 <= literal.size() ; ++j) {
+        buckets.push_back(trigramBucket(literal.data() + j));
+    }
+    sort(buckets.begin(), buckets.end());
+    buckets.erase(unique(buckets.begin(), buckets.end()), buckets.end());
+
+    // Starting from the smallest bucket keeps the intersections small.
+    auto size = [&](uint32_t b) { return this->bucket_starts_[b + 1] - this->bucket_starts_[b]; };
+    sort(buckets.begin(), buckets.end(), [&](uint32_t a, uint32_t b) { return size(a) < size(b); });
+
+    auto first = this->postings_.begin();
+    vector<uint32_t> candidates(first + this->bucket_starts_[buckets[0]], first + this->bucket_starts_[buckets[0] + 1]);
+    for (size_t k = 1 ; k < buckets.size() && !candidates.empty() ; ++k) {
+        vector<uint32_t> both;
+        set_intersection(candidates.begin(), candidates.end(),
+                         first + this->bucket_starts_[buckets[k]], first + this->bucket_starts_[buckets[k] + 1],
+                         back_inserter(both));
+        candidates.swap(both);
+    }
+    return candidates;
+}
+
+vector<bool> NameIndex::Match(string_view query, NameFilterMode mode) const {
+    string q;
+    for (char c : query) {
+        q.push_back(toLower(c));
+    }
+
+    auto matches = [&](uint32_t i) {
+        auto name = this->Name(i);
+        switch (mode) {
+            case NAME_FILTER_GLOB:
+                return globMatch(name, q);
+            case NAME_FILTER_FUZZY:
+                return fuzzyMatch(name, q);
+            default:
+                return name.find(q) != string_view::npos;
+        }
+    };
+
+    string_view literal;
+    if (mode == NAME_FILTER_SUBSTRING) {
+        literal = q;
+    } else if (mode == NAME_FILTER_GLOB) {
+        literal = globLiteral(q);
+    }
+
+    size_t n = this->name_starts_.size() - 1;
+    vector<bool> r(n, false);
+    if (literal.size() >= 3) {
+        for (auto i : this->Candidates(literal)) {
+            r[i] = matches(i);
+        }
+    } else if (mode == NAME_FILTER_SUBSTRING && !q.empty()) {
+        // Too short for trigrams, but one search through all names at once is still quicker than one per name.
+        size_t i = 0;
+        for (size_t pos = this->names_.find(q) ; pos != string::npos ; pos = this->names_.find(q, pos + 1)) {
+            while (this->name_starts_[i + 1] <= pos) {
+                i++;
+            }
+            if (pos + q.size() <= this->name_starts_[i + 1]) {
+                r[i] = true;
+                pos = this->name_starts_[i + 1] - 1;  // On to the next name.
+            }
+        }
+    } else {
+        uint64_t mask = mode == NAME_FILTER_FUZZY ? charMask(q) : 0;
+        for (uint32_t i = 0 ; i < n ; ++i) {
+            r[i] = (this->char_masks_[i] & mask) == mask && matches(i);
+        }
+    }
+
+    if (this->parent_dir_ >= 0) {
+        r[this->parent_dir_] = true;
+    }
+    return r;
+}
@@ -0,0 +1,49 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_NAMEINDEX_H_
+#define SRC_NAMEINDEX_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/dirlisting.h"
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+enum NameFilterMode {
+    NAME_FILTER_SUBSTRING,
+    NAME_FILTER_GLOB,  // The whole name against a pattern with *, ? and [...].
+    NAME_FILTER_FUZZY,  // The characters of the query in order, with anything between them.
+};
+
+// The names of a listing, indexed for filtering as the user types. Names are lowercased once, into one buffer. For
+// each trigram, hashed into a fixed number of buckets, the entries containing it are listed, so a query only checks
+// the entries that have all of its trigrams, rather than every name.
+class NameIndex {
+private:
+    DirListingView source_;
+    bool built_ = false;
+    string names_;
+    vector<uint32_t> name_starts_;
+    vector<uint64_t> char_masks_;  // Which characters each name has, for ruling out fuzzy matches.
+    vector<uint32_t> bucket_starts_;
+    vector<uint32_t> postings_;
+    int64_t parent_dir_ = -1;
+
+    string_view Name(size_t i) const;
+
+    vector<uint32_t> Candidates(string_view literal) const;
+
+public:
+    // Indexes the entries of view, unless it is of the listing already indexed.
+    void Build(const DirListingView &view);
+
+    // Marks the entries that match query, ignoring case, by their index over all parts, as DirListingView::SetOrder
+    // takes them. ".." always matches, so there is always a way up.
+    vector<bool> Match(string_view query, NameFilterMode mode) const;
+};
+
+#endif  // SRC_NAMEINDEX_H_
@@ -106,6 +106,48 @@ PreferencesPageGeneralPanel::PreferencesPageGeneralPanel(wxWindow *parent, wxCon
     this->size_units_->Append("Bytes");
     item_sizer_size_unit->Add(this->size_units_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
 
+    auto item_sizer_compress = new wxBoxSizer(wxHORIZONTAL);
+    sizer->Add(item_sizer_compress, 0, wxGROW | wxALL, 5);
+    this->compress_transfers_ = new wxCheckBox(this, wxID_ANY, "Compress large file transfers with gzip on the server");
+    item_sizer_compress->Add(this->compress_transfers_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
+    auto item_sizer_bulk_listing = new wxBoxSizer(wxHORIZONTAL);
+    sizer->Add(item_sizer_bulk_listing, 0, wxGROW | wxALL, 5);
+    this->bulk_listing_ = new wxCheckBox(
+            this, wxID_ANY, "List directories with find on the server, which is faster for huge directories");
+    item_sizer_bulk_listing->Add(this->bulk_listing_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
+    auto item_sizer_transfer_sessions = new wxBoxSizer(wxHORIZONTAL);
+    sizer->Add(item_sizer_transfer_sessions, 0, wxGROW | wxALL, 5);
+    auto label_transfer_sessions = new wxStaticText(
+            this, wxID_ANY, "Extra SFTP channels for downloads and uploads, so browsing goes on meanwhile:");
+    item_sizer_transfer_sessions->Add(label_transfer_sessions, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+    item_sizer_transfer_sessions->Add(5, 5, 1, wxALL, 0);
+    this->transfer_sessions_ = new wxChoice(this, wxID_ANY, wxDefaultPosition, wxSize(80, -1));
+    this->transfer_sessions_->Append("None");
+    for (int i = 1 ; i <= 4 ; ++i) {
+        this->transfer_sessions_->Append(wxString::Format("%d", i));
+    }
+    item_sizer_transfer_sessions->Add(this->transfer_sessions_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
+    auto item_sizer_picture_types = new wxBoxSizer(wxHORIZONTAL);
+    sizer->Add(item_sizer_picture_types, 0, wxGROW | wxALL, 5);
+    auto label_picture_types = new wxStaticText(this, wxID_ANY, "More picture file suffixes:");
+    item_sizer_picture_types->Add(label_picture_types, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+    item_sizer_picture_types->Add(5, 5, 1, wxALL, 0);
+    this->picture_types_ = new wxTextCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxSize(300, -1));
+    this->picture_types_->SetHint("For example: heic, raw");
+    item_sizer_picture_types->Add(this->picture_types_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
+    auto item_sizer_archive_types = new wxBoxSizer(wxHORIZONTAL);
+    sizer->Add(item_sizer_archive_types, 0, wxGROW | wxALL, 5);
+    auto label_archive_types = new wxStaticText(this, wxID_ANY, "More archive file suffixes:");
+    item_sizer_archive_types->Add(label_archive_types, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+    item_sizer_archive_types->Add(5, 5, 1, wxALL, 0);
+    this->archive_types_ = new wxTextCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxSize(300, -1));
+    this->archive_types_->SetHint("For example: rar, zst");
+    item_sizer_archive_types->Add(this->archive_types_, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
     this->SetSizerAndFit(sizer);
 }
 
@@ -119,6 +161,16 @@ bool PreferencesPageGeneralPanel::TransferDataToWindow() {
         this->size_units_->SetSelection(0);
     }
 
+    this->compress_transfers_->SetValue(this->config_->Read("/compress_transfers", "0") == "1");
+    this->bulk_listing_->SetValue(this->config_->Read("/bulk_listing", "0") == "1");
+    int transfer_sessions = this->config_->Read("/transfer_sessions", 2);
+    if (transfer_sessions < 0 || transfer_sessions >= static_cast<int>(this->transfer_sessions_->GetCount())) {
+        transfer_sessions = 2;
+    }
+    this->transfer_sessions_->SetSelection(transfer_sessions);
+    this->picture_types_->SetValue(this->config_->Read("/picture_types", ""));
+    this->archive_types_->SetValue(this->config_->Read("/archive_types", ""));
+
     // Setting up the on-change binds here, so we only start monitoring for change after values have been loaded.
     this->editor_path_->Bind(wxEVT_TEXT, [&](wxCommandEvent &) {
         if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
@@ -130,6 +182,31 @@ bool PreferencesPageGeneralPanel::TransferDataToWindow() {
             this->TransferDataFromWindow();
         }
     });
+    this->compress_transfers_->Bind(wxEVT_CHECKBOX, [&](wxCommandEvent &) {
+        if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
+            this->TransferDataFromWindow();
+        }
+    });
+    this->bulk_listing_->Bind(wxEVT_CHECKBOX, [&](wxCommandEvent &) {
+        if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
+            this->TransferDataFromWindow();
+        }
+    });
+    this->transfer_sessions_->Bind(wxEVT_CHOICE, [&](wxCommandEvent &) {
+        if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
+            this->TransferDataFromWindow();
+        }
+    });
+    this->picture_types_->Bind(wxEVT_TEXT, [&](wxCommandEvent &) {
+        if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
+            this->TransferDataFromWindow();
+        }
+    });
+    this->archive_types_->Bind(wxEVT_TEXT, [&](wxCommandEvent &) {
+        if (wxPreferencesEditor::ShouldApplyChangesImmediately()) {
+            this->TransferDataFromWindow();
+        }
+    });
 
     return true;
 }
@@ -143,6 +220,12 @@ bool PreferencesPageGeneralPanel::TransferDataFromWindow() {
         this->config_->Write("/size_units", "1");
     }
 
+    this->config_->Write("/compress_transfers", this->compress_transfers_->GetValue() ? "1" : "0");
+    this->config_->Write("/bulk_listing", this->bulk_listing_->GetValue() ? "1" : "0");
+    this->config_->Write("/transfer_sessions", this->transfer_sessions_->GetSelection());  // For new connections.
+    this->config_->Write("/picture_types", this->picture_types_->GetValue());
+    this->config_->Write("/archive_types", this->archive_types_->GetValue());
+
     this->config_->Flush();
     return true;
 }
@@ -17,6 +17,11 @@ class PreferencesPageGeneralPanel : public wxPanel {
     wxConfigBase *config_;
     wxTextCtrl *editor_path_;
     wxChoice *size_units_;
+    wxCheckBox *compress_transfers_;
+    wxCheckBox *bulk_listing_;
+    wxChoice *transfer_sessions_;
+    wxTextCtrl *picture_types_;
+    wxTextCtrl *archive_types_;
 
 public:
     PreferencesPageGeneralPanel(wxWindow *parent, wxConfigBase *config);
@@ -25,10 +25,15 @@
 #include <utime.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <future>  // NOLINT
 #include <optional>
 #include <regex>  // NOLINT
 #include <string>
+#include <thread>  // NOLINT
+#include <utility>
 #include <vector>
 
 #ifndef __WXOSX__
@@ -38,21 +43,41 @@
 #endif
 
 #include "./version.h"
+#include "src/channel.h"
 #include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/findlisting.h"
+#include "src/gzipstream.h"
 #include "src/hostdesc.h"
+#include "src/paths.h"
+#include "src/sftprawchannel.h"
 #include "src/string.h"
 
+using std::async;
+using std::atomic;
+using std::deque;
 using std::exception;
 using std::function;
+using std::future;
+using std::launch;
+using std::lock_guard;
+using std::make_shared;
+using std::make_unique;
+using std::max;
+using std::move;
+using std::mutex;
+using std::pair;
 using std::nullopt;
 using std::optional;
 using std::regex;
 using std::regex_replace;
 using std::regex_search;
 using std::string;
-using std::stringstream;
+using std::string_view;
 using std::to_string;
+using std::unique_lock;
 using std::vector;
+using std::chrono::milliseconds;
 using std::chrono::steady_clock;
 
 #ifndef __WXOSX__
@@ -64,6 +89,22 @@ using std::filesystem::exists;
 #define BUFLEN 4096
 #define LARGE_BUFLEN 65536
 
+// Below this size, the extra round trips for starting gzip on the remote are not worth it.
+#define COMPRESS_MIN_FILE_SIZE (1024 * 1024)
+// Block size for the independently compressed gzip members when uploading.
+#define COMPRESS_BLOCK_LEN (1024 * 1024)
+// Fastest level, so that the remote CPU and the local threads keep up with fast links.
+#define COMPRESS_LEVEL 1
+// Max number of received compressed chunks waiting for the decompression thread.
+#define DECOMPRESS_QUEUE_LEN 16
+// Number of SSH_FXP_READDIR requests kept outstanding while listing a directory.
+#define READDIR_IN_FLIGHT 8
+// Number of SSH_FXP_STAT requests kept outstanding when stat'ing many files, such as the symlinks in a directory.
+#define STAT_IN_FLIGHT 64
+// A partially listed directory is reported after this many new entries, or after this long, whichever comes first.
+#define DIR_PROGRESS_BATCH_LEN 1000
+#define DIR_PROGRESS_INTERVAL_MS 100
+
 // RAII wrapper to ensure LIBSSH2_SFTP_HANDLE gets closed.
 class SftpHandle {
 public:
@@ -93,6 +134,24 @@ public:
     }
 };
 
+// RAII wrapper to hold the session of an SftpConnection for the duration of one of its methods.
+class SessionGuard {
+public:
+    SftpConnection *conn_;
+
+    explicit SessionGuard(SftpConnection *conn) : conn_(conn) {
+        if (this->conn_->ssh_lock_depth_++ == 0) {
+            this->conn_->ssh_->Lock();
+        }
+    }
+
+    ~SessionGuard() {
+        if (--this->conn_->ssh_lock_depth_ == 0) {
+            this->conn_->ssh_->Unlock();
+        }
+    }
+};
+
 // RAII wrapper to ensure FILE gets closed.
 class FileHandle {
 public:
@@ -107,6 +166,67 @@ public:
     }
 };
 
+// Set modified time of a local file, for example to the modified time of the remote file it was downloaded from.
+static void setLocalModified(string local_path, uint64_t modified) {
+#ifdef __WXMSW__
+    struct _stat s;
+    _wstat(localPathUnicode(local_path).c_str(), &s);
+    struct _utimbuf t;
+    t.actime = s.st_atime;
+    t.modtime = modified;
+    _wutime(localPathUnicode(local_path).c_str(), &t);
+#else
+    struct stat s;
+    stat(local_path.c_str(), &s);
+    struct utimbuf t;
+    t.actime = s.st_atime;
+    t.modtime = modified;
+    utime(local_path.c_str(), &t);
+#endif
+}
+
+SshSession::~SshSession() {
+    if (this->session_) {
+        libssh2_session_disconnect(this->session_, "normal shutdown");
+        libssh2_session_free(this->session_);
+    }
+
+    if (this->sock_) {
+#ifdef __WXMSW__
+        closesocket(this->sock_);
+#else
+        close(this->sock_);
+#endif
+    }
+
+    libssh2_exit();
+}
+
+void SshSession::Lock() {
+    unique_lock<mutex> lock(this->mutex_);
+    uint64_t ticket = this->next_ticket_++;
+    this->turn_.wait(lock, [&]() { return this->serving_ == ticket; });
+}
+
+void SshSession::Unlock() {
+    {
+        lock_guard<mutex> lock(this->mutex_);
+        this->serving_++;
+    }
+    this->turn_.notify_all();
+}
+
+void SshSession::GiveTurn() {
+    {
+        lock_guard<mutex> lock(this->mutex_);
+        if (this->next_ticket_ == this->serving_ + 1) {
+            return;  // Nobody else is waiting.
+        }
+    }
+    this->Unlock();
+    this->Lock();
+}
+
 SftpConnection::SftpConnection(HostDesc host_desc) {
     this->host_desc_ = host_desc;
 
@@ -124,6 +244,7 @@ SftpConnection::SftpConnection(HostDesc host_desc) {
     if (rc != 0) {
         throw ConnectionError("libssh2_init failed. " + this->GetLastErrorMsg());
     }
+    this->ssh_ = make_shared<SshSession>();  // Calls libssh2_exit when done with.
 
     struct addrinfo *result;
     struct addrinfo hints;
@@ -138,16 +259,17 @@ SftpConnection::SftpConnection(HostDesc host_desc) {
 
     struct addrinfo *rp;
     for (rp = result ; rp != NULL ; rp = rp->ai_next) {
-        this->sock_ = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (this->sock_ == -1) {
+        int sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock == -1) {
             continue;
         }
 
-        if (connect(this->sock_, rp->ai_addr, rp->ai_addrlen) != -1) {
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) {
+            this->ssh_->sock_ = sock;
             break;  // Success
         }
 
-        close(this->sock_);
+        close(sock);
     }
 
     freeaddrinfo(result);
@@ -157,6 +279,7 @@ SftpConnection::SftpConnection(HostDesc host_desc) {
     }
 
     this->session_ = libssh2_session_init();
+    this->ssh_->session_ = this->session_;
     if (!this->session_) {
         throw ConnectionError("libssh2_session_init failed. " + this->GetLastErrorMsg());
     }
@@ -165,7 +288,7 @@ SftpConnection::SftpConnection(HostDesc host_desc) {
     libssh2_session_set_timeout(this->session_, 10 * 1000);  // TODO(allan): higher timeout?
     libssh2_session_banner_set(this->session_, "SSH-2.0-FilesRemote_" PROJECT_VERSION);
 
-    rc = libssh2_session_handshake(this->session_, this->sock_);
+    rc = libssh2_session_handshake(this->session_, this->ssh_->sock_);
     if (rc) {
         throw ConnectionError("libssh2_session_handshake failed. " + this->GetLastErrorMsg());
     }
@@ -198,7 +321,19 @@ SftpConnection::SftpConnection(HostDesc host_desc) {
     }
 }
 
+SftpConnection::SftpConnection(HostDesc host_desc, shared_ptr<SshSession> ssh) {
+    this->host_desc_ = host_desc;
+    this->ssh_ = ssh;
+    this->session_ = ssh->session_;
+
+    SessionGuard guard(this);
+    this->SftpSubsystemInit();
+}
+
 SftpConnection::~SftpConnection() {
+    // Only the channels of this SftpConnection are closed. The session goes with the last one using it.
+    SessionGuard guard(this);
+    this->raw_channel_ = nullptr;
     this->SudoExit();
     if (this->sudo_channel_) {
         libssh2_channel_send_eof(this->sudo_channel_);
@@ -211,24 +346,89 @@ SftpConnection::~SftpConnection() {
     if (this->sftp_session_) {
         libssh2_sftp_shutdown(this->sftp_session_);
     }
+}
 
-    if (this->session_) {
-        libssh2_session_disconnect(this->session_, "normal shutdown");
-        libssh2_session_free(this->session_);
+shared_ptr<SshSession> SftpConnection::Session() {
+    return this->ssh_;
+}
+
+// Returns the space separated field starting at or after *pos, and moves *pos past it.
+static string_view nextField(string_view line, size_t *pos) {
+    size_t start = line.find_first_not_of(' ', *pos);
+    if (start == string_view::npos) {
+        *pos = line.size();
+        return string_view();
     }
+    size_t end = line.find(' ', start);
+    if (end == string_view::npos) {
+        end = line.size();
+    }
+    *pos = end;
+    return line.substr(start, end - start);
+}
 
-    if (this->sock_) {
-#ifdef __WXMSW__
-        closesocket(this->sock_);
-#else
-        close(this->sock_);
-#endif
+// Builds a DirEntry from a directory listing entry. User and group come from the free text line, which servers format
+// like "ls -l" does.
+static DirEntry makeDirEntry(string_view name, string_view longname, const LIBSSH2_SFTP_ATTRIBUTES &attrs) {
+    auto d = DirEntry(attrs);
+    d.name_ = string(name);
+
+    size_t pos = 0;
+    string_view mode = nextField(longname, &pos);
+    if (mode.length() != 10) {
+        return d;  // Free text line was missing or in an unexpected format.
     }
+    nextField(longname, &pos);  // Link count.
+    string_view owner = nextField(longname, &pos);
+    d.owner_.assign(owner.data(), owner.size());
+    string_view group = nextField(longname, &pos);
+    d.group_.assign(group.data(), group.size());
 
-    libssh2_exit();
+    return d;
 }
 
-vector<DirEntry> SftpConnection::GetDir(string path) {
+// Passes the entries of a directory being listed to an OnDirProgressCb in batches.
+class DirProgressReporter {
+    OnDirProgressCb on_progress_;
+    size_t reported_ = 0;
+    steady_clock::time_point last_report_ = steady_clock::now();
+
+public:
+    bool cancelled_ = false;
+
+    explicit DirProgressReporter(OnDirProgressCb on_progress) : on_progress_(on_progress) {}
+
+    // Returns false if the listing was cancelled.
+    bool Update(const DirListing &entries) {
+        if (!this->on_progress_) {
+            return true;
+        }
+
+        auto now = steady_clock::now();
+        if (entries.Count() - this->reported_ < DIR_PROGRESS_BATCH_LEN
+            && now - this->last_report_ < milliseconds(DIR_PROGRESS_INTERVAL_MS)) {
+            return true;
+        }
+
+        this->cancelled_ = !this->on_progress_(entries, this->reported_);
+        this->reported_ = entries.Count();
+        this->last_report_ = now;
+        return !this->cancelled_;
+    }
+
+    bool HasReported() {
+        return this->reported_ > 0;
+    }
+};
+
+DirListing SftpConnection::GetDir(string path, OnDirProgressCb on_progress) {
+    SessionGuard guard(this);
+
+    // The raw channel is not sudo'ed, so it can only be used when not in sudo mode.
+    if (!this->sudo_ && this->GetRawChannel()) {
+        return this->GetDirPipelined(path, on_progress);
+    }
+
     int rc;
 
     auto sftp_handle_ = SftpHandle(libssh2_sftp_opendir(this->sftp_session_, path.c_str()));
@@ -242,19 +442,20 @@ vector<DirEntry> SftpConnection::GetDir(string path) {
             if (err == LIBSSH2_FX_NO_SUCH_PATH || err == LIBSSH2_FX_NO_SUCH_FILE || err == LIBSSH2_FX_NO_MEDIA) {
                 throw FileNotFound(path);
             }
+
+            throw DirListFailed(path, "listing directory failed with SFTP status " + to_string(err));
         }
 
         throw ConnectionError("libssh2_sftp_opendir failed. " + this->GetLastErrorMsg());
     }
 
-    auto files = vector<DirEntry>();
+    auto files = DirListing();
+    DirProgressReporter reporter(on_progress);
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    char name[BUFLEN];
+    char line[BUFLEN];
     while (1) {
-        LIBSSH2_SFTP_ATTRIBUTES attrs;
-        char name[BUFLEN];
-        char line[BUFLEN];
-        memset(name, 0, BUFLEN);
-        memset(line, 0, BUFLEN);
-
+        this->ssh_->GiveTurn();
         rc = libssh2_sftp_readdir_ex(sftp_handle_.handle_, name, sizeof(name), line, sizeof(line), &attrs);
         if (rc == LIBSSH2_ERROR_EAGAIN) {
             continue;
@@ -262,61 +463,200 @@ vector<DirEntry> SftpConnection::GetDir(string path) {
         if (rc == 0) {
             break;
         }
+        if (rc == LIBSSH2_ERROR_SFTP_PROTOCOL) {
+            uint64_t err = libssh2_sftp_last_error(this->sftp_session_);
+            throw DirListFailed(path, "listing directory failed with SFTP status " + to_string(err));
+        }
         if (rc < 0) {
             throw ConnectionError("libssh2_sftp_readdir_ex failed. " + this->GetLastErrorMsg());
         }
 
-        auto d = DirEntry(attrs);
-
-        d.name_ = string(name);
-        if (d.name_ == ".") {
+        string_view n(name, rc);
+        if (n == ".") {
             continue;
         }
 
-        // Extract user, group and mode string from the free text line.
-        stringstream s(line);
-        string segment;
-        vector<string> parts;
-        int field_num = 0;
-        while (getline(s, segment, ' ')) {
-            if (segment.empty()) {
-                continue;
-            }
+        files.Add(makeDirEntry(n, string_view(line), attrs));
+        if (!reporter.Update(files)) {
+            break;
+        }
+    }
 
-            if (field_num == 0) {
-                if (segment.length() != 10) {
-                    // Free text line was in an unexpected format.
-                    break;
-                }
-                d.mode_str_ = string(segment);
-            }
+    if (files.Empty() && !reporter.cancelled_) {
+        throw DirListFailedPermission(path);
+    }
 
-            if (field_num == 2) {
-                d.owner_ = string(segment);
-            }
+    return files;
+}
 
-            if (field_num == 3) {
-                d.group_ = string(segment);
-            }
+// Finds out what the symlinks among files point at, with the stat requests for all of them sent in one go, so that
+// links to dirs can be shown and opened as dirs.
+static void resolveSymlinks(SftpRawChannel *channel, string path, DirListing *files) {
+    vector<size_t> links;
+    vector<string> link_paths;
+    for (size_t i = 0 ; i < files->Count() ; ++i) {
+        if (LIBSSH2_SFTP_S_ISLNK(files->Mode(i))) {
+            links.push_back(i);
+            link_paths.push_back(normalize_path(path + "/" + string(files->Name(i))));
+        }
+    }
+    if (links.empty()) {
+        return;
+    }
 
-            field_num++;
+    channel->StatMany(link_paths, STAT_IN_FLIGHT, [&](size_t i, const LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+        if (!attrs || !(attrs->flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)) {
+            return;  // Dangling, or pointing somewhere we may not look.
         }
+        uint64_t size = attrs->flags & LIBSSH2_SFTP_ATTR_SIZE ? attrs->filesize : files->FileSize(links[i]);
+        files->SetLinkTarget(links[i], LIBSSH2_SFTP_S_ISDIR(attrs->permissions), size);
+    });
+}
 
-        files.push_back(d);
+// Lists via the raw channel, with several SSH_FXP_READDIR requests in flight.
+DirListing SftpConnection::GetDirPipelined(string path, OnDirProgressCb on_progress) {
+    auto files = DirListing();
+    DirProgressReporter reporter(on_progress);
+    try {
+        this->raw_channel_->ReadDir(path, READDIR_IN_FLIGHT, [&](
+                string_view name, string_view longname, const LIBSSH2_SFTP_ATTRIBUTES &attrs) {
+            if (name == ".") {
+                return true;
+            }
+            files.Add(makeDirEntry(name, longname, attrs));
+            this->ssh_->GiveTurn();
+            return reporter.Update(files);
+        });
+        if (!reporter.cancelled_) {
+            resolveSymlinks(this->raw_channel_.get(), path, &files);
+        }
+    } catch (SftpStatusError e) {
+        if (e.code_ == LIBSSH2_FX_PERMISSION_DENIED) {
+            throw DirListFailedPermission(path);
+        }
+        if (e.code_ == LIBSSH2_FX_NO_SUCH_PATH || e.code_ == LIBSSH2_FX_NO_SUCH_FILE || e.code_ == LIBSSH2_FX_NO_MEDIA) {
+            throw FileNotFound(path);
+        }
+        throw DirListFailed(path, "listing directory failed with SFTP status " + to_string(e.code_));
+    } catch (ConnectionError) {
+        // Requests may still be outstanding, so the channel can't be reused.
+        this->raw_channel_ = nullptr;
+        throw;
     }
 
-    if (files.size() == 0) {
+    if (files.Empty() && !reporter.cancelled_) {
         throw DirListFailedPermission(path);
     }
 
     return files;
 }
 
+DirListing SftpConnection::GetDirBulk(string path, OnDirProgressCb on_progress) {
+    SessionGuard guard(this);
+
+    if (this->sudo_ || !this->RemoteHasFindListing()) {
+        return this->GetDir(path, on_progress);
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    string cmd = findListingCommand(path);
+    int rc = libssh2_channel_exec(channel.channel_, cmd.c_str());
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    auto files = DirListing();
+    DirProgressReporter reporter(on_progress);
+    FindListingParser parser;
+    char buf[LARGE_BUFLEN];
+    while (1) {
+        this->ssh_->GiveTurn();
+        ssize_t n = libssh2_channel_read(channel.channel_, buf, LARGE_BUFLEN);
+        if (n == LIBSSH2_ERROR_EAGAIN) {
+            continue;
+        }
+        if (n < 0) {
+            throw ConnectionError("libssh2_channel_read failed. " + this->GetLastErrorMsg());
+        }
+        if (n == 0) {
+            break;
+        }
+
+        parser.Feed(string_view(buf, n), &files);
+        if (!reporter.Update(files)) {
+            return files;
+        }
+    }
+
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    int status = libssh2_channel_get_exit_status(channel.channel_);
+    if (status != 0 || !parser.AtRecordBoundary()) {
+        // Let plain SFTP produce the precise error, if there is one. Entries already passed to on_progress can't be
+        // taken back, so then the listing only arrives at the end.
+        return this->GetDir(path, reporter.HasReported() ? nullptr : on_progress);
+    }
+
+    return files;
+}
+
+optional<DirListing> SftpConnection::GetSubdirsBulk(string path) {
+    SessionGuard guard(this);
+
+    if (this->sudo_ || !this->RemoteHasFindListing()) {
+        return nullopt;
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    string cmd = findSubdirsCommand(path);
+    int rc = libssh2_channel_exec(channel.channel_, cmd.c_str());
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    auto subdirs = DirListing();
+    FindListingParser parser;
+    char buf[LARGE_BUFLEN];
+    while (1) {
+        this->ssh_->GiveTurn();
+        ssize_t n = libssh2_channel_read(channel.channel_, buf, LARGE_BUFLEN);
+        if (n == LIBSSH2_ERROR_EAGAIN) {
+            continue;
+        }
+        if (n < 0) {
+            throw ConnectionError("libssh2_channel_read failed. " + this->GetLastErrorMsg());
+        }
+        if (n == 0) {
+            break;
+        }
+        parser.Feed(string_view(buf, n), &subdirs);
+    }
+
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    int status = libssh2_channel_get_exit_status(channel.channel_);
+    if (status != 0 || !parser.AtRecordBoundary()) {
+        return nullopt;
+    }
+
+    return subdirs;
+}
+
 bool SftpConnection::DownloadFile(
         string remote_src_path,
         string local_dst_path,
         function<bool(void)> cancelled,
         function<void(string, uint64_t, uint64_t, uint64_t)> progress) {
+    SessionGuard guard(this);
+
     auto sftp_handle_ = SftpHandle(
             libssh2_sftp_open(
                     this->sftp_session_,
@@ -357,6 +697,7 @@ bool SftpConnection::DownloadFile(
             if (cancelled && cancelled()) {
                 return false;
             }
+            this->ssh_->GiveTurn();  // Between chunks, so that listing goes on meanwhile on other channels.
             int rc = libssh2_sftp_read(sftp_handle_.handle_, buf, LARGE_BUFLEN);
             if (rc > 0) {
                 fwrite(buf, 1, rc, local_file_handle_.handle_);
@@ -385,23 +726,10 @@ bool SftpConnection::DownloadFile(
         }
     }
 
-    // Set modified to the remote modified time.
-#ifdef __WXMSW__
-    struct _stat s;
-    _wstat(localPathUnicode(local_dst_path).c_str(), &s);
-    struct _utimbuf t;
-    t.actime = s.st_atime;
-    t.modtime = entry.modified_;
-    _wutime(localPathUnicode(local_dst_path).c_str(), &t);
-#else
-    struct stat s;
-    stat(local_dst_path.c_str(), &s);
-    struct utimbuf t;
-    t.actime = s.st_atime;
-    t.modtime = entry.modified_;
-    utime(local_dst_path.c_str(), &t);
-#endif
+    setLocalModified(local_dst_path, entry.modified_);
 
+    this->last_transfer_wire_bytes_ = entry.size_;
+    this->last_transfer_file_bytes_ = entry.size_;
     return true;
 }
 
@@ -410,6 +738,8 @@ bool SftpConnection::UploadFile(
         string remote_dst_path,
         function<bool(void)> cancelled,
         function<void(string, uint64_t, uint64_t, uint64_t)> progress) {
+    SessionGuard guard(this);
+
     int mode = LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR | LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH;
     auto sftp_openfile_handle_ = SftpHandle(
             libssh2_sftp_open(
@@ -450,6 +780,7 @@ bool SftpConnection::UploadFile(
         if (cancelled && cancelled()) {
             return false;
         }
+        this->ssh_->GiveTurn();
         int rc = fread(buf, 1, LARGE_BUFLEN, local_file_handle_.handle_);
         if (rc > 0) {
             int nremain = rc;
@@ -491,21 +822,308 @@ bool SftpConnection::UploadFile(
         }
     }
 
+    this->last_transfer_wire_bytes_ = sent;
+    this->last_transfer_file_bytes_ = sent;
     return true;
 }
 
-optional<DirEntry> SftpConnection::Stat(string remote_path) {
-    auto sftp_handle_ = SftpHandle(
-            libssh2_sftp_open(
-                    this->sftp_session_,
-                    remote_path.c_str(),
-                    0,
-                    0));
+bool SftpConnection::DownloadFileCompressed(
+        string remote_src_path,
+        string local_dst_path,
+        function<bool(void)> cancelled,
+        function<void(string, uint64_t, uint64_t, uint64_t)> progress) {
+    SessionGuard guard(this);
 
-    if (!sftp_handle_.handle_) {
+    if (this->sudo_) {
+        return this->DownloadFile(remote_src_path, local_dst_path, cancelled, progress);
+    }
+
+    auto entry = this->Stat(remote_src_path);
+    if (!entry.has_value() || entry->is_dir_ || entry->size_ < COMPRESS_MIN_FILE_SIZE || !this->RemoteHasGzip()) {
+        return this->DownloadFile(remote_src_path, local_dst_path, cancelled, progress);
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    string cmd = "gzip -" + to_string(COMPRESS_LEVEL) + " -c -- " + shellQuote(remote_src_path);
+    int rc = libssh2_channel_exec(channel.channel_, cmd.c_str());
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    uint64_t wire_bytes = 0;
+    atomic<uint64_t> file_bytes(0);
+    atomic<bool> write_failed(false);
+    bool was_cancelled = false;
+    bool decompressed_ok;
+
+    {  // Scoping for local_file_handle_
+#ifdef __WXMSW__
+        auto local_file_handle_ = FileHandle(_wfopen(localPathUnicode(local_dst_path).c_str(), L"wb"));
+#else
+        auto local_file_handle_ = FileHandle(fopen(local_dst_path.c_str(), "wb"));
+#endif
+        if (!local_file_handle_.handle_) {
+            throw DownloadFailed(remote_src_path);
+        }
+
+        // Received compressed chunks are decompressed and written on a separate thread, while this thread keeps
+        // reading from the network. An empty chunk marks the end. Credits bound how far the reader can get ahead.
+        Channel<string> chunks;
+        Channel<bool> credits;
+        for (int i = 0 ; i < DECOMPRESS_QUEUE_LEN ; ++i) {
+            credits.Put(true);
+        }
+
+        auto decompress_thread = async(launch::async, [&]() {
+            GzipInflater inflater;
+            bool ok = true;
+            while (1) {
+                string chunk = chunks.Get();
+                credits.Put(true);
+                if (chunk.empty()) {
+                    break;
+                }
+                if (!ok) {
+                    continue;  // Keep draining, so the reader never waits for credits that will not come.
+                }
+                ok = inflater.Write(chunk.data(), chunk.size(), [&](const char *p, size_t n) {
+                    if (write_failed) {
+                        return;
+                    }
+                    if (fwrite(p, 1, n, local_file_handle_.handle_) != n) {
+                        write_failed = true;  // For example a full disk.
+                        return;
+                    }
+                    file_bytes += n;
+                }) && !write_failed;
+            }
+            return ok && inflater.Finished();
+        });
+
+        auto start_time = steady_clock::now();
+        uint64_t prev_file_bytes = 0;
+        char buf[LARGE_BUFLEN];
+        while (1) {
+            if (cancelled && cancelled()) {
+                was_cancelled = true;
+                break;
+            }
+            if (write_failed) {
+                break;  // No point in fetching the rest, the download fails below.
+            }
+
+            this->ssh_->GiveTurn();
+            ssize_t n = libssh2_channel_read(channel.channel_, buf, LARGE_BUFLEN);
+            if (n == LIBSSH2_ERROR_EAGAIN) {
+                continue;
+            }
+            if (n < 0) {
+                chunks.Put(string());
+                decompress_thread.wait();
+                throw ConnectionError("libssh2_channel_read failed. " + this->GetLastErrorMsg());
+            }
+            if (n == 0) {
+                break;
+            }
+
+            credits.Get();
+            chunks.Put(string(buf, n));
+            wire_bytes += n;
+
+            auto now = steady_clock::now();
+            auto d = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
+            if (d > 500) {
+                uint64_t done = file_bytes;
+                if (progress) {
+                    uint64_t bytes_per_sec = static_cast<uint64_t>((static_cast<float>(done - prev_file_bytes)) /
+                                                                   (static_cast<float>(d) / 1000.0));
+                    progress(remote_src_path, done, entry->size_, bytes_per_sec);
+                }
+                start_time = now;
+                prev_file_bytes = done;
+            }
+        }
+
+        chunks.Put(string());
+        decompressed_ok = decompress_thread.get();
+    }
+
+    if (was_cancelled) {
+        return false;
+    }
+
+    char buf[BUFLEN];
+    string err_output = "";
+    while (1) {
+        ssize_t n = libssh2_channel_read_stderr(channel.channel_, buf, BUFLEN);
+        if (n <= 0) {
+            break;
+        }
+        err_output += string(buf, n);
+    }
+
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    int status = libssh2_channel_get_exit_status(channel.channel_);
+    if (status != 0 || !decompressed_ok) {
+        if (wire_bytes == 0) {
+            // Could not even start, for example due to permissions. Let plain SFTP produce the precise error.
+            return this->DownloadFile(remote_src_path, local_dst_path, cancelled, progress);
+        }
+        throw DownloadFailed(remote_src_path);
+    }
+
+    setLocalModified(local_dst_path, entry->modified_);
+
+    this->last_transfer_wire_bytes_ = wire_bytes;
+    this->last_transfer_file_bytes_ = file_bytes;
+    return true;
+}
+
+bool SftpConnection::UploadFileCompressed(
+        string local_src_path,
+        string remote_dst_path,
+        function<bool(void)> cancelled,
+        function<void(string, uint64_t, uint64_t, uint64_t)> progress) {
+    SessionGuard guard(this);
+
+#ifdef __WXMSW__
+    auto local_file_handle_ = FileHandle(_wfopen(localPathUnicode(local_src_path).c_str(), L"rb"));
+#else
+    auto local_file_handle_ = FileHandle(fopen(local_src_path.c_str(), "rb"));
+#endif
+    if (!local_file_handle_.handle_) {
+        throw UploadFailed(remote_dst_path);
+    }
+
+    fseek(local_file_handle_.handle_, 0, SEEK_END);
+    uint64_t file_len = ftell(local_file_handle_.handle_);
+    fseek(local_file_handle_.handle_, 0, SEEK_SET);
+
+    if (this->sudo_ || file_len < COMPRESS_MIN_FILE_SIZE || !this->RemoteHasGzip()) {
+        return this->UploadFile(local_src_path, remote_dst_path, cancelled, progress);
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    string cmd = "gzip -d -c > " + shellQuote(remote_dst_path);
+    int rc = libssh2_channel_exec(channel.channel_, cmd.c_str());
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    // Blocks are compressed as independent gzip members on a pool of threads, and sent in order.
+    size_t max_pending = max(2u, std::thread::hardware_concurrency());
+    deque<pair<size_t, future<string>>> pending;
+    bool eof = false;
+
+    uint64_t wire_bytes = 0, file_bytes = 0, prev_file_bytes = 0;
+    auto start_time = steady_clock::now();
+    while (1) {
+        if (cancelled && cancelled()) {
+            return false;  // Destructors of the pending futures wait for their threads.
+        }
+        this->ssh_->GiveTurn();
+
+        while (!eof && pending.size() < max_pending) {
+            string block(COMPRESS_BLOCK_LEN, '\0');
+            size_t n = fread(&block[0], 1, COMPRESS_BLOCK_LEN, local_file_handle_.handle_);
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            block.resize(n);
+            pending.push_back(make_pair(n, async(launch::async, [block = move(block)]() {
+                return gzipCompressMember(block.data(), block.size(), COMPRESS_LEVEL);
+            })));
+        }
+
+        if (pending.empty()) {
+            break;
+        }
+
+        size_t n = pending.front().first;
+        string compressed = pending.front().second.get();
+        pending.pop_front();
+
+        const char *p = compressed.data();
+        size_t nremain = compressed.size();
+        while (nremain) {
+            ssize_t written = libssh2_channel_write(channel.channel_, p, nremain);
+            if (written == LIBSSH2_ERROR_EAGAIN) {
+                continue;
+            }
+            if (written < 0) {
+                throw ConnectionError("libssh2_channel_write failed. " + this->GetLastErrorMsg());
+            }
+            p += written;
+            nremain -= written;
+        }
+        wire_bytes += compressed.size();
+        file_bytes += n;
+
+        auto now = steady_clock::now();
+        auto d = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
+        if (d > 500) {
+            if (progress) {
+                uint64_t bytes_per_sec = static_cast<uint64_t>((static_cast<float>(file_bytes - prev_file_bytes)) /
+                                                               (static_cast<float>(d) / 1000.0));
+                progress(remote_dst_path, file_bytes, file_len, bytes_per_sec);
+            }
+            start_time = now;
+            prev_file_bytes = file_bytes;
+        }
+    }
+
+    libssh2_channel_send_eof(channel.channel_);
+
+    char buf[BUFLEN];
+    string err_output = "";
+    while (1) {
+        ssize_t n = libssh2_channel_read_stderr(channel.channel_, buf, BUFLEN);
+        if (n <= 0) {
+            break;
+        }
+        err_output += string(buf, n);
+    }
+
+    libssh2_channel_wait_eof(channel.channel_);
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    int status = libssh2_channel_get_exit_status(channel.channel_);
+    if (status != 0) {
+        if (regex_search(err_output, regex("No space left"))) {
+            throw UploadFailedSpace(remote_dst_path);
+        }
+        if (regex_search(err_output, regex("Permission denied|Read-only file system"))) {
+            throw FailedPermission(remote_dst_path);
+        }
+        throw UploadFailed(remote_dst_path);
+    }
+
+    this->last_transfer_wire_bytes_ = wire_bytes;
+    this->last_transfer_file_bytes_ = file_bytes;
+    return true;
+}
+
+optional<DirEntry> SftpConnection::Stat(string remote_path, bool follow_links) {
+    SessionGuard guard(this);
+
+    // A single SSH_FXP_STAT or SSH_FXP_LSTAT, which also works for files we may not open.
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int rc = libssh2_sftp_stat_ex(this->sftp_session_, remote_path.c_str(), remote_path.size(),
+                                  follow_links ? LIBSSH2_SFTP_STAT : LIBSSH2_SFTP_LSTAT, &attrs);
+    if (rc != 0) {
         if (libssh2_session_last_errno(this->session_) == LIBSSH2_ERROR_SFTP_PROTOCOL) {
             uint64_t err = libssh2_sftp_last_error(this->sftp_session_);
-            if (err == LIBSSH2_FX_PERMISSION_DENIED || err == LIBSSH2_FX_WRITE_PROTECT) {
+            if (err == LIBSSH2_FX_PERMISSION_DENIED) {
                 throw FailedPermission(remote_path);
             }
             return nullopt;
@@ -513,16 +1131,44 @@ optional<DirEntry> SftpConnection::Stat(string remote_path) {
         throw ConnectionError(this->GetLastErrorMsg());
     }
 
-    LIBSSH2_SFTP_ATTRIBUTES attrs;
-    if (libssh2_sftp_fstat(sftp_handle_.handle_, &attrs) != 0) {
-        throw ConnectionError(this->GetLastErrorMsg());
-    }
-
     DirEntry entry(attrs);
     return entry;
 }
 
+vector<optional<DirEntry>> SftpConnection::Stat(const vector<string> &remote_paths) {
+    SessionGuard guard(this);
+
+    vector<optional<DirEntry>> entries(remote_paths.size());
+
+    // The raw channel is not sudo'ed, so it can only be used when not in sudo mode.
+    if (this->sudo_ || !this->GetRawChannel()) {
+        for (size_t i = 0 ; i < remote_paths.size() ; ++i) {
+            try {
+                entries[i] = this->Stat(remote_paths[i]);
+            } catch (FailedPermission) {
+                // Left as nullopt.
+            }
+        }
+        return entries;
+    }
+
+    try {
+        this->raw_channel_->StatMany(remote_paths, STAT_IN_FLIGHT, [&](size_t i, const LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+            if (attrs) {
+                entries[i] = DirEntry(*attrs);
+            }
+        });
+    } catch (ConnectionError) {
+        // Requests may still be outstanding, so the channel can't be reused.
+        this->raw_channel_ = nullptr;
+        throw;
+    }
+    return entries;
+}
+
 void SftpConnection::Rename(string remote_old_path, string remote_new_path) {
+    SessionGuard guard(this);
+
     int rc = libssh2_sftp_rename(this->sftp_session_, remote_old_path.c_str(), remote_new_path.c_str());
     if (rc != 0) {
         if (libssh2_session_last_errno(this->session_) == LIBSSH2_ERROR_SFTP_PROTOCOL) {
@@ -537,9 +1183,12 @@ void SftpConnection::Rename(string remote_old_path, string remote_new_path) {
 }
 
 void SftpConnection::Delete(string remote_path) {
+    SessionGuard guard(this);
+
     int rc;
 
-    auto entry = this->Stat(remote_path);
+    // A symlink to a dir is removed like a file, rather than what it points at.
+    auto entry = this->Stat(remote_path, false);
     if (entry.has_value() && !entry->is_dir_) {  // Single files are easiest to just do via the SFTP channel.
         rc = libssh2_sftp_unlink(this->sftp_session_, remote_path.c_str());
         if (rc != 0) {
@@ -604,6 +1253,8 @@ void SftpConnection::Delete(string remote_path) {
 }
 
 void SftpConnection::Mkdir(string remote_path) {
+    SessionGuard guard(this);
+
     int mode = LIBSSH2_SFTP_S_IRWXU | LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IXGRP | LIBSSH2_SFTP_S_IROTH |
                LIBSSH2_SFTP_S_IXOTH;
     int rc = libssh2_sftp_mkdir(this->sftp_session_, remote_path.c_str(), mode);
@@ -620,6 +1271,8 @@ void SftpConnection::Mkdir(string remote_path) {
 }
 
 void SftpConnection::Mkfile(string remote_path) {
+    SessionGuard guard(this);
+
     int mode = LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR | LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH;
     auto sftp_openfile_handle_ = SftpHandle(
             libssh2_sftp_open(
@@ -645,6 +1298,8 @@ void SftpConnection::Mkfile(string remote_path) {
 }
 
 string SftpConnection::RealPath(string remote_path) {
+    SessionGuard guard(this);
+
     char buf[BUFLEN];
     int rc = libssh2_sftp_realpath(this->sftp_session_, remote_path.c_str(), buf, BUFLEN);
     if (rc < 0) {
@@ -675,6 +1330,8 @@ static void kbd_callback(
 }
 
 bool SftpConnection::PasswordAuth(wxSecretValue passwd) {
+    SessionGuard guard(this);
+
     auto p = reinterpret_cast<const char *>(passwd.GetData());
 
     if (regex_search(this->userauth_list, regex("(^|,)password($|,)"))) {
@@ -714,6 +1371,8 @@ bool SftpConnection::PasswordAuth(wxSecretValue passwd) {
 }
 
 bool SftpConnection::AgentAuth() {
+    SessionGuard guard(this);
+
     if (!regex_search(this->userauth_list, regex("(^|,)publickey($|,)"))) {
         return false;
     }
@@ -748,6 +1407,8 @@ bool SftpConnection::AgentAuth() {
 }
 
 bool SftpConnection::KeyAuth() {
+    SessionGuard guard(this);
+
     for (auto path : this->host_desc_.identity_files_) {
         try {
             if (exists(path)) {
@@ -782,6 +1443,8 @@ void SftpConnection::SendKeepAlive() {
 }
 
 void SftpConnection::SftpSubsystemInit() {
+    SessionGuard guard(this);
+
     this->sftp_session_ = libssh2_sftp_init(this->session_);
     if (!this->sftp_session_) {
         throw ConnectionError("libssh2_sftp_init failed. " + this->GetLastErrorMsg());
@@ -798,6 +1461,8 @@ static void _htonu32(char *buf, uint32_t value) {
 }
 
 void SftpConnection::SudoEnter(bool needs_passwd_again) {
+    SessionGuard guard(this);
+
     if (this->sudo_) {
         return;
     }
@@ -826,8 +1491,9 @@ void SftpConnection::SudoEnter(bool needs_passwd_again) {
             "/usr/libexec/openssh/sftp-server"
     };
     string sftp_server_path;
+    auto found = this->Stat(sftp_server_paths);
     for (int i = 0 ; i < sftp_server_paths.size() ; ++i) {
-        if (this->Stat(sftp_server_paths[i]).has_value()) {
+        if (found[i].has_value()) {
             sftp_server_path = sftp_server_paths[i];
             break;
         }
@@ -893,6 +1559,8 @@ void SftpConnection::SudoExit() {
 }
 
 bool SftpConnection::CheckSudoInstalled() {
+    SessionGuard guard(this);
+
     ChannelHandle channel(libssh2_channel_open_session(this->session_));
     if (!channel.channel_) {
         throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
@@ -915,6 +1583,8 @@ bool SftpConnection::CheckSudoInstalled() {
 }
 
 bool SftpConnection::CheckSudoNeedsPasswd() {
+    SessionGuard guard(this);
+
     ChannelHandle channel(libssh2_channel_open_session(this->session_));
     if (!channel.channel_) {
         throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
@@ -944,6 +1614,8 @@ bool SftpConnection::CheckSudoNeedsPasswd() {
 }
 
 void SftpConnection::VerifySudoPasswd() {
+    SessionGuard guard(this);
+
     ChannelHandle channel(libssh2_channel_open_session(this->session_));
     if (!channel.channel_) {
         throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
@@ -1018,6 +1690,64 @@ void SftpConnection::VerifySudoStillValid() {
     }
 }
 
+// Lazily opens the raw SFTP channel. Returns NULL if the server does not allow an extra channel, in which case the
+// callers fall back to libssh2's SFTP API.
+SftpRawChannel *SftpConnection::GetRawChannel() {
+    if (!this->raw_channel_ && !this->raw_channel_unavailable_) {
+        try {
+            this->raw_channel_ = make_unique<SftpRawChannel>(this->session_);
+        } catch (ConnectionError) {
+            this->raw_channel_unavailable_ = true;
+        }
+    }
+    return this->raw_channel_.get();
+}
+
+bool SftpConnection::RemoteHasGzip() {
+    if (this->remote_has_gzip_.has_value()) {
+        return *this->remote_has_gzip_;
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    int rc = libssh2_channel_exec(channel.channel_, "which gzip");
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    libssh2_channel_wait_eof(channel.channel_);
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    this->remote_has_gzip_ = libssh2_channel_get_exit_status(channel.channel_) == 0;
+    return *this->remote_has_gzip_;
+}
+
+bool SftpConnection::RemoteHasFindListing() {
+    if (this->remote_has_find_listing_.has_value()) {
+        return *this->remote_has_find_listing_;
+    }
+
+    ChannelHandle channel(libssh2_channel_open_session(this->session_));
+    if (!channel.channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed. " + this->GetLastErrorMsg());
+    }
+
+    // Asked once up front, since a listing that fails can't tell a missing find from a dir that can't be listed.
+    int rc = libssh2_channel_exec(channel.channel_, "find / -maxdepth 0 -printf x");
+    if (rc != 0) {
+        throw ConnectionError("libssh2_channel_exec failed. " + this->GetLastErrorMsg());
+    }
+
+    libssh2_channel_wait_eof(channel.channel_);
+    libssh2_channel_close(channel.channel_);
+    libssh2_channel_wait_closed(channel.channel_);
+    this->remote_has_find_listing_ = libssh2_channel_get_exit_status(channel.channel_) == 0;
+    return *this->remote_has_find_listing_;
+}
+
 string SftpConnection::GetLastErrorMsg() {
     char *errmsg;
     libssh2_session_last_error(this->session_, &errmsg, NULL, 0);
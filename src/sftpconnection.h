@@ -5,21 +5,36 @@
 
 #include <wx/secretstore.h>
 
+#include <condition_variable>  // NOLINT
 #include <future>  // NOLINT
+#include <memory>
+#include <mutex>  // NOLINT
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "src/direntry.h"
+#include "src/dirlisting.h"
 #include "src/hostdesc.h"
 #include "src/string.h"
 
+using std::condition_variable;
 using std::exception;
 using std::function;
+using std::mutex;
 using std::optional;
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 
+class SftpRawChannel;
+class SessionGuard;
+
+// Called every now and then while listing a directory, with the entries listed so far. The ones from first_new
+// onwards have not been passed to the callback before. Return false to cancel the listing.
+typedef function<bool(const DirListing &entries, size_t first_new)> OnDirProgressCb;
+
 class DownloadFailed : public exception {
 public:
     string remote_path_;
@@ -84,6 +99,15 @@ public:
     explicit ConnectionError(string msg) : msg_(msg) {}
 };
 
+// The server turned down listing a dir with an SFTP status other than for permissions or a missing dir. The
+// connection itself is fine, but it is still a ConnectionError for callers that don't tell the two apart.
+class DirListFailed : public ConnectionError {
+public:
+    string remote_path_;
+
+    explicit DirListFailed(string remote_path, string msg) : ConnectionError(msg), remote_path_(remote_path) {}
+};
+
 class SudoFailed : public exception {
 public:
     string msg_;
@@ -92,25 +116,81 @@ public:
 };
 
 
-class SftpConnection {
+// The SSH connection itself, which the SftpConnection that opened it shares with those opened on it afterwards, each
+// with SFTP channels of their own. libssh2 only allows one thread at a time in a session, so it is only used between
+// Lock and Unlock. Threads get their turns in the order they asked, so one taking turns with GiveTurn during a long
+// transfer doesn't keep the others waiting for long.
+class SshSession {
 private:
+    mutex mutex_;
+    condition_variable turn_;
+    uint64_t next_ticket_ = 0;
+    uint64_t serving_ = 0;
+
+public:
     LIBSSH2_SESSION *session_ = NULL;
-    LIBSSH2_SFTP *sftp_session_ = NULL;
     int sock_ = 0;
+
+    SshSession() = default;
+
+    ~SshSession();
+
+    SshSession(const SshSession &) = delete;
+
+    SshSession &operator=(const SshSession &) = delete;
+
+    void Lock();
+
+    void Unlock();
+
+    // Unlocks and locks again, if another thread is waiting for its turn.
+    void GiveTurn();
+};
+
+class SftpConnection {
+private:
+    friend class SessionGuard;
+
+    shared_ptr<SshSession> ssh_;
+    int ssh_lock_depth_ = 0;  // Methods call each other, so the session is only locked by the outermost one.
+    LIBSSH2_SESSION *session_ = NULL;  // Same as ssh_->session_.
+    LIBSSH2_SFTP *sftp_session_ = NULL;
     bool sudo_ = false;
     char *userauth_list = NULL;
     LIBSSH2_CHANNEL *sudo_channel_ = NULL;
     LIBSSH2_CHANNEL *non_sudo_channel_ = NULL;
+    optional<bool> remote_has_gzip_;
+    optional<bool> remote_has_find_listing_;
+    unique_ptr<SftpRawChannel> raw_channel_;
+    bool raw_channel_unavailable_ = false;
 
 public:
     string home_dir_ = "";
     HostDesc host_desc_;
     string fingerprint_ = "";
     wxSecretValue sudo_passwd_ = wxSecretValue();
+    uint64_t last_transfer_wire_bytes_ = 0;  // Bytes sent over the connection by the latest upload or download.
+    uint64_t last_transfer_file_bytes_ = 0;  // Bytes of file content moved by the latest upload or download.
 
     explicit SftpConnection(HostDesc host_desc);
 
-    vector<DirEntry> GetDir(string path);
+    // Opens SFTP channels on the session of another SftpConnection, which is already authenticated, rather than
+    // connecting again. The two can be used from different threads.
+    SftpConnection(HostDesc host_desc, shared_ptr<SshSession> ssh);
+
+    shared_ptr<SshSession> Session();
+
+    // Lists a directory. If the listing is cancelled by on_progress, the entries listed until then are returned.
+    DirListing GetDir(string path, OnDirProgressCb on_progress = nullptr);
+
+    // Like GetDir, but lists with a single find command on the remote via an exec channel, which is much quicker for
+    // huge directories. Falls back to GetDir while in sudo mode, if find fails, or if the remote has no GNU find.
+    DirListing GetDirBulk(string path, OnDirProgressCb on_progress = nullptr);
+
+    // Lists only the subdirs of path, including symlinks to dirs, with find on the remote, so that the files of huge
+    // dirs don't have to come over. Returns nullopt where GetDirBulk would fall back to GetDir, which is then left to
+    // the caller.
+    optional<DirListing> GetSubdirsBulk(string path);
 
     bool DownloadFile(
             string remote_src_path,
@@ -124,7 +204,28 @@ public:
             function<bool(void)> cancelled,
             function<void(string, uint64_t, uint64_t, uint64_t)> progress);
 
-    optional<DirEntry> Stat(string remote_path);
+    // Like DownloadFile, but streams the file through gzip on the remote via an exec channel. Falls back to
+    // DownloadFile for small files, while in sudo mode, or if gzip is not available on the remote.
+    bool DownloadFileCompressed(
+            string remote_src_path,
+            string local_dst_path,
+            function<bool(void)> cancelled,
+            function<void(string, uint64_t, uint64_t, uint64_t)> progress);
+
+    // Like UploadFile, but compresses locally on multiple threads and decompresses via gzip on the remote. Falls back
+    // to UploadFile under the same conditions as DownloadFileCompressed.
+    bool UploadFileCompressed(
+            string local_src_path,
+            string remote_dst_path,
+            function<bool(void)> cancelled,
+            function<void(string, uint64_t, uint64_t, uint64_t)> progress);
+
+    // Returns nullopt if nothing is at remote_path. Symlinks are followed unless follow_links is false.
+    optional<DirEntry> Stat(string remote_path, bool follow_links = true);
+
+    // Stats several paths at once, with the requests pipelined on the raw channel when it can be used. Paths that
+    // could not be stat'ed, for whatever reason, come back as nullopt.
+    vector<optional<DirEntry>> Stat(const vector<string> &remote_paths);
 
     ~SftpConnection();
 
@@ -161,6 +262,15 @@ public:
 private:
     string GetLastErrorMsg();
 
+    bool RemoteHasGzip();
+
+    // Whether the remote has a find that supports -printf, as listing with find needs.
+    bool RemoteHasFindListing();
+
+    SftpRawChannel *GetRawChannel();
+
+    DirListing GetDirPipelined(string path, OnDirProgressCb on_progress);
+
     void SendSudoPasswd(LIBSSH2_CHANNEL *channel);
 
     void VerifySudoStillValid();
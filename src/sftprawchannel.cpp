@@ -0,0 +1,329 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/sftprawchannel.h"
+
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/sftpconnection.h"
+
+using std::string;
+using std::string_view;
+using std::to_string;
+using std::vector;
+
+#define SSH_FXP_INIT 1
+#define SSH_FXP_VERSION 2
+#define SSH_FXP_CLOSE 4
+#define SSH_FXP_OPENDIR 11
+#define SSH_FXP_READDIR 12
+#define SSH_FXP_STAT 17
+#define SSH_FXP_STATUS 101
+#define SSH_FXP_HANDLE 102
+#define SSH_FXP_NAME 104
+#define SSH_FXP_ATTRS 105
+
+#define READ_BUFLEN 65536
+#define MAX_PACKET_LEN (1024 * 1024)  // OpenSSH's sftp-server never sends more than 256 KiB in one packet.
+
+static void putU32(string *buf, uint32_t value) {
+    buf->push_back((value >> 24) & 0xFF);
+    buf->push_back((value >> 16) & 0xFF);
+    buf->push_back((value >> 8) & 0xFF);
+    buf->push_back(value & 0xFF);
+}
+
+static void putString(string *buf, string_view s) {
+    putU32(buf, s.size());
+    buf->append(s.data(), s.size());
+}
+
+// Starts a packet with a placeholder for the length, which finishPacket fills in.
+static string startPacket(uint8_t type) {
+    string buf(4, '\0');
+    buf.push_back(type);
+    return buf;
+}
+
+static void finishPacket(string *buf) {
+    uint32_t len = buf->size() - 4;
+    (*buf)[0] = (len >> 24) & 0xFF;
+    (*buf)[1] = (len >> 16) & 0xFF;
+    (*buf)[2] = (len >> 8) & 0xFF;
+    (*buf)[3] = len & 0xFF;
+}
+
+// Decodes fields from a received packet without copying.
+class PacketReader {
+    const unsigned char *p_;
+    const unsigned char *end_;
+
+    void Need(size_t n) {
+        if (static_cast<size_t>(this->end_ - this->p_) < n) {
+            throw ConnectionError("malformed SFTP packet");
+        }
+    }
+
+public:
+    explicit PacketReader(string_view packet)
+            : p_(reinterpret_cast<const unsigned char *>(packet.data())),
+              end_(reinterpret_cast<const unsigned char *>(packet.data() + packet.size())) {}
+
+    uint8_t U8() {
+        this->Need(1);
+        return *this->p_++;
+    }
+
+    uint32_t U32() {
+        this->Need(4);
+        uint32_t v = (uint32_t(this->p_[0]) << 24) | (uint32_t(this->p_[1]) << 16) | (uint32_t(this->p_[2]) << 8)
+                     | uint32_t(this->p_[3]);
+        this->p_ += 4;
+        return v;
+    }
+
+    uint64_t U64() {
+        uint64_t hi = this->U32();
+        return (hi << 32) | this->U32();
+    }
+
+    string_view Str() {
+        uint32_t len = this->U32();
+        this->Need(len);
+        auto s = string_view(reinterpret_cast<const char *>(this->p_), len);
+        this->p_ += len;
+        return s;
+    }
+
+    LIBSSH2_SFTP_ATTRIBUTES Attrs() {
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        memset(&attrs, 0, sizeof(attrs));
+        attrs.flags = this->U32();
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
+            attrs.filesize = this->U64();
+        }
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+            attrs.uid = this->U32();
+            attrs.gid = this->U32();
+        }
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+            attrs.permissions = this->U32();
+        }
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+            attrs.atime = this->U32();
+            attrs.mtime = this->U32();
+        }
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_EXTENDED) {
+            uint32_t count = this->U32();
+            for (uint32_t i = 0 ; i < count ; ++i) {
+                this->Str();  // Extended type.
+                this->Str();  // Extended data.
+            }
+        }
+        return attrs;
+    }
+};
+
+SftpRawChannel::SftpRawChannel(LIBSSH2_SESSION *session) : session_(session) {
+    this->channel_ = libssh2_channel_open_session(this->session_);
+    if (!this->channel_) {
+        throw ConnectionError("libssh2_channel_open_session failed for raw SFTP channel");
+    }
+
+    if (libssh2_channel_subsystem(this->channel_, "sftp") != 0) {
+        libssh2_channel_free(this->channel_);
+        this->channel_ = NULL;
+        throw ConnectionError("libssh2_channel_subsystem failed for raw SFTP channel");
+    }
+
+    // SSH_FXP_INIT has no request id, only the version.
+    string packet = startPacket(SSH_FXP_INIT);
+    putU32(&packet, LIBSSH2_SFTP_VERSION);
+    finishPacket(&packet);
+    this->SendPacket(packet);
+
+    PacketReader r(this->ReadPacket());
+    if (r.U8() != SSH_FXP_VERSION) {
+        throw ConnectionError("unexpected reply to SSH_FXP_INIT on raw SFTP channel");
+    }
+}
+
+SftpRawChannel::~SftpRawChannel() {
+    if (this->channel_) {
+        libssh2_channel_send_eof(this->channel_);
+        libssh2_channel_close(this->channel_);
+        libssh2_channel_free(this->channel_);
+    }
+}
+
+void SftpRawChannel::ReadDir(string path, int max_in_flight, OnRawDirEntryCb on_entry) {
+    uint32_t opendir_id = this->SendPathRequest(SSH_FXP_OPENDIR, path);
+    string handle = this->ExpectHandle(opendir_id);
+
+    int in_flight = 0;
+    bool done = false;
+    bool aborted = false;
+    uint32_t error = LIBSSH2_FX_OK;
+
+    for (; in_flight < max_in_flight ; ++in_flight) {
+        this->SendPathRequest(SSH_FXP_READDIR, handle);
+    }
+
+    // The server answers the requests in order, each with the next batch of entries, until it reaches the end of the
+    // directory and answers the remaining outstanding requests with SSH_FX_EOF.
+    while (in_flight > 0) {
+        PacketReader r(this->ReadPacket());
+        in_flight--;
+
+        uint8_t type = r.U8();
+        r.U32();  // Request id.
+        if (type == SSH_FXP_STATUS) {
+            uint32_t code = r.U32();
+            if (code != LIBSSH2_FX_EOF && error == LIBSSH2_FX_OK) {
+                error = code;
+            }
+            done = true;
+        } else if (type == SSH_FXP_NAME) {
+            uint32_t count = r.U32();
+            for (uint32_t i = 0 ; i < count ; ++i) {
+                string_view name = r.Str();
+                string_view longname = r.Str();
+                LIBSSH2_SFTP_ATTRIBUTES attrs = r.Attrs();
+                if (!aborted && !on_entry(name, longname, attrs)) {
+                    aborted = true;
+                }
+            }
+        } else {
+            throw ConnectionError("unexpected SFTP packet type " + to_string(type) + " while listing directory");
+        }
+
+        if (!done && !aborted) {
+            this->SendPathRequest(SSH_FXP_READDIR, handle);
+            in_flight++;
+        }
+    }
+
+    this->CloseHandle(handle);
+
+    if (error != LIBSSH2_FX_OK) {
+        throw SftpStatusError(error);
+    }
+}
+
+void SftpRawChannel::StatMany(const vector<string> &paths, int max_in_flight, OnRawStatCb on_attrs) {
+    uint32_t first_id = this->next_id_;
+    size_t sent = 0;
+    size_t received = 0;
+    while (received < paths.size()) {
+        while (sent < paths.size() && sent - received < static_cast<size_t>(max_in_flight)) {
+            this->SendPathRequest(SSH_FXP_STAT, paths[sent++]);
+        }
+
+        PacketReader r(this->ReadPacket());
+        received++;
+
+        uint8_t type = r.U8();
+        size_t i = static_cast<uint32_t>(r.U32() - first_id);
+        if (i >= sent) {
+            throw ConnectionError("unexpected SFTP reply id on raw SFTP channel");
+        }
+        if (type == SSH_FXP_ATTRS) {
+            LIBSSH2_SFTP_ATTRIBUTES attrs = r.Attrs();
+            on_attrs(i, &attrs);
+        } else if (type == SSH_FXP_STATUS) {
+            on_attrs(i, NULL);
+        } else {
+            throw ConnectionError("unexpected SFTP packet type " + to_string(type) + " while stat'ing files");
+        }
+    }
+}
+
+// Sends a request of the common form: type, id, string. The string is a path or a handle.
+uint32_t SftpRawChannel::SendPathRequest(uint8_t type, string_view path) {
+    uint32_t id = this->next_id_++;
+    string packet = startPacket(type);
+    putU32(&packet, id);
+    putString(&packet, path);
+    finishPacket(&packet);
+    this->SendPacket(packet);
+    return id;
+}
+
+void SftpRawChannel::SendPacket(const string &packet) {
+    const char *p = packet.data();
+    size_t nremain = packet.size();
+    while (nremain) {
+        ssize_t rc = libssh2_channel_write(this->channel_, p, nremain);
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            continue;
+        }
+        if (rc < 0) {
+            throw ConnectionError("libssh2_channel_write failed on raw SFTP channel");
+        }
+        p += rc;
+        nremain -= rc;
+    }
+}
+
+// Returns the payload of the next packet, starting with the type byte. Valid until the next call.
+string_view SftpRawChannel::ReadPacket() {
+    this->in_buf_.erase(0, this->consumed_);
+    this->consumed_ = 0;
+
+    this->Fill(4);
+    auto p = reinterpret_cast<const unsigned char *>(this->in_buf_.data());
+    uint32_t len = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    if (len == 0 || len > MAX_PACKET_LEN) {
+        throw ConnectionError("invalid SFTP packet length on raw SFTP channel");
+    }
+
+    this->Fill(4 + len);
+    this->consumed_ = 4 + len;
+    return string_view(this->in_buf_.data() + 4, len);
+}
+
+// Reads from the channel until at least n bytes are buffered.
+void SftpRawChannel::Fill(size_t n) {
+    char buf[READ_BUFLEN];
+    while (this->in_buf_.size() < n) {
+        ssize_t rc = libssh2_channel_read(this->channel_, buf, READ_BUFLEN);
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            continue;
+        }
+        if (rc < 0) {
+            throw ConnectionError("libssh2_channel_read failed on raw SFTP channel");
+        }
+        if (rc == 0) {
+            throw ConnectionError("raw SFTP channel closed by server");
+        }
+        this->in_buf_.append(buf, rc);
+    }
+}
+
+string SftpRawChannel::ExpectHandle(uint32_t id) {
+    PacketReader r(this->ReadPacket());
+    uint8_t type = r.U8();
+    if (r.U32() != id) {
+        throw ConnectionError("unexpected SFTP reply id on raw SFTP channel");
+    }
+    if (type == SSH_FXP_STATUS) {
+        throw SftpStatusError(r.U32());
+    }
+    if (type != SSH_FXP_HANDLE) {
+        throw ConnectionError("unexpected SFTP packet type " + to_string(type) + " while expecting handle");
+    }
+    return string(r.Str());
+}
+
+void SftpRawChannel::CloseHandle(string_view handle) {
+    uint32_t id = this->SendPathRequest(SSH_FXP_CLOSE, handle);
+    PacketReader r(this->ReadPacket());
+    if (r.U8() != SSH_FXP_STATUS || r.U32() != id) {
+        throw ConnectionError("unexpected reply to SSH_FXP_CLOSE on raw SFTP channel");
+    }
+}
@@ -0,0 +1,77 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_SFTPRAWCHANNEL_H_
+#define SRC_SFTPRAWCHANNEL_H_
+
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+
+#include <exception>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::exception;
+using std::function;
+using std::string;
+using std::string_view;
+using std::vector;
+
+// An SSH_FXP_STATUS error reply from the server, for example LIBSSH2_FX_PERMISSION_DENIED.
+class SftpStatusError : public exception {
+public:
+    uint32_t code_;
+
+    explicit SftpStatusError(uint32_t code) : code_(code) {}
+};
+
+typedef function<bool(string_view name, string_view longname, const LIBSSH2_SFTP_ATTRIBUTES &attrs)> OnRawDirEntryCb;
+
+typedef function<void(size_t i, const LIBSSH2_SFTP_ATTRIBUTES *attrs)> OnRawStatCb;
+
+// Speaks the SFTP protocol directly on its own channel of an existing SSH session, similar to how SudoEnter talks to
+// a sudo'ed sftp-server. libssh2's SFTP API waits for each reply before sending the next request, whereas this keeps
+// several requests in flight to hide the round trip time.
+class SftpRawChannel {
+private:
+    LIBSSH2_SESSION *session_;
+    LIBSSH2_CHANNEL *channel_ = NULL;
+    uint32_t next_id_ = 1;
+    string in_buf_;
+    size_t consumed_ = 0;
+
+public:
+    explicit SftpRawChannel(LIBSSH2_SESSION *session);
+
+    ~SftpRawChannel();
+
+    SftpRawChannel(const SftpRawChannel &) = delete;
+
+    SftpRawChannel &operator=(const SftpRawChannel &) = delete;
+
+    // Lists a directory, keeping up to max_in_flight SSH_FXP_READDIR requests outstanding. Names and attributes are
+    // decoded straight from the received packets, and are only valid during the callback. The callback can return
+    // false to abort the listing.
+    void ReadDir(string path, int max_in_flight, OnRawDirEntryCb on_entry);
+
+    // Stats each of paths, following symlinks, keeping up to max_in_flight SSH_FXP_STAT requests outstanding. The
+    // callback gets the index into paths, and NULL attributes for paths that could not be stat'ed, such as dangling
+    // symlinks.
+    void StatMany(const vector<string> &paths, int max_in_flight, OnRawStatCb on_attrs);
+
+private:
+    uint32_t SendPathRequest(uint8_t type, string_view path);
+
+    void SendPacket(const string &packet);
+
+    string_view ReadPacket();
+
+    void Fill(size_t n);
+
+    string ExpectHandle(uint32_t id);
+
+    void CloseHandle(string_view handle);
+};
+
+#endif  // SRC_SFTPRAWCHANNEL_H_
@@ -12,40 +12,58 @@
 #include <chrono>  // NOLINT
 #include <memory>
 #include <string>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "src/channel.h"
+#include "src/contenthash.h"
 #include "src/direntry.h"
+#include "src/dirlisting.h"
 #include "src/hostdesc.h"
+#include "src/paths.h"
 #include "src/sftpconnection.h"
 
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::get_if;
+using std::make_shared;
 using std::make_unique;
+using std::move;
+using std::nullopt;
+using std::optional;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::variant;
 using std::vector;
 
+// Each sftpThreadFunc runs on a thread of its own, so this tells the responses of the sessions apart.
+static thread_local int response_session = 0;
+
 template<typename T>
 static void respondToUIThread(wxEvtHandler *response_dest, int id, const T &payload) {
     wxThreadEvent event(wxEVT_THREAD, id);
     event.SetPayload(payload);
+    event.SetInt(response_session);
     wxQueueEvent(response_dest, event.Clone());
 }
 
 static void respondToUIThread(wxEvtHandler *response_dest, int id) {
     wxThreadEvent event(wxEVT_THREAD, id);
+    event.SetInt(response_session);
     wxQueueEvent(response_dest, event.Clone());
 }
 
 void sftpThreadFunc(
         wxEvtHandler *response_dest,
         shared_ptr<Channel<threadFuncVariant>> cmd_channel,
-        shared_ptr<Channel<bool>> cancellation_channel) {
+        shared_ptr<Channel<bool>> cancellation_channel,
+        int session) {
     unique_ptr<SftpConnection> sftp_connection;
+    response_session = session;
 
     auto cancel = [&] {
         auto r = cancellation_channel->TryGet();
@@ -63,6 +81,19 @@ void sftpThreadFunc(
                           SftpThreadResponseProgress{remote_path, bytes_done, bytes_total, bytes_per_sec});
     };
 
+    // Looks up something we just created, so the UI can add it to its cached listing rather than list the dir again.
+    auto stat_created = [&](string remote_path) -> optional<DirEntry> {
+        try {
+            auto entry = sftp_connection->Stat(remote_path);
+            if (entry.has_value()) {
+                entry->name_ = basename(remote_path);
+            }
+            return entry;
+        } catch (FailedPermission) {
+            return nullopt;
+        }
+    };
+
     while (1) {
         auto cmd_opt = cmd_channel->Get(seconds(15));
 
@@ -73,7 +104,7 @@ void sftpThreadFunc(
         try {
             if (cmd_opt.has_value()) {
                 cmd = *cmd_opt;
-            } else if (!sftp_connection->home_dir_.empty()) {
+            } else if (sftp_connection && !sftp_connection->home_dir_.empty()) {
                 sftp_connection->SendKeepAlive();
                 continue;
             } else {
@@ -94,6 +125,29 @@ void sftpThreadFunc(
                 continue;
             }
 
+            if (get_if<SftpThreadCmdConnectPooled>(&cmd)) {
+                auto m = get_if<SftpThreadCmdConnectPooled>(&cmd);
+
+                sftp_connection = nullptr;  // Closes the channels of a previous session first.
+                sftp_connection = make_unique<SftpConnection>(m->host_desc, m->session);
+
+                if (m->sudo) {
+                    sftp_connection->sudo_passwd_ = m->sudo_password;
+                    // Failing that is failing to open the session, not the browsing connection failing to sudo.
+                    try {
+                        if (sftp_connection->CheckSudoNeedsPasswd()) {
+                            sftp_connection->VerifySudoPasswd();
+                        }
+                        sftp_connection->SudoEnter(sftp_connection->CheckSudoNeedsPasswd());
+                    } catch (SudoFailed e) {
+                        throw ConnectionError(e.msg_);
+                    }
+                }
+
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_POOL_CONNECTED);
+                continue;
+            }
+
             if (get_if<SftpThreadCmdFingerprintApproved>(&cmd)) {
                 auto m = get_if<SftpThreadCmdFingerprintApproved>(&cmd);
 
@@ -113,7 +167,7 @@ void sftpThreadFunc(
                 }
 
                 respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_CONNECTED,
-                                  SftpThreadResponseConnected{sftp_connection->home_dir_});
+                                  SftpThreadResponseConnected{sftp_connection->home_dir_, sftp_connection->Session()});
                 continue;
             }
 
@@ -125,15 +179,92 @@ void sftpThreadFunc(
                 }
 
                 respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_CONNECTED,
-                                  SftpThreadResponseConnected{sftp_connection->home_dir_});
+                                  SftpThreadResponseConnected{sftp_connection->home_dir_, sftp_connection->Session()});
                 continue;
             }
 
             if (get_if<SftpThreadCmdGetDir>(&cmd)) {
                 auto m = get_if<SftpThreadCmdGetDir>(&cmd);
-                auto dir_list = sftp_connection->GetDir(m->dir);
+                auto start = steady_clock::now();
+                bool cancelled = false;
+                auto on_progress = [&](const DirListing &entries, size_t first_new) {
+                    auto new_entries = make_shared<DirListing>();
+                    new_entries->AddRange(entries, first_new, entries.Count());
+                    respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_GET_DIR_PARTIAL,
+                                      SftpThreadResponseGetDirPartial{m->dir, m->seq, new_entries});
+                    cancelled = cancel();
+                    return !cancelled;
+                };
+                DirListing dir_list;
+                if (m->bulk) {
+                    dir_list = sftp_connection->GetDirBulk(m->dir, on_progress);
+                } else {
+                    dir_list = sftp_connection->GetDir(m->dir, on_progress);
+                }
+                auto listing_ms = duration_cast<milliseconds>(steady_clock::now() - start).count();
                 respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_GET_DIR,
-                                  SftpThreadResponseGetDir{m->dir, dir_list});
+                                  SftpThreadResponseGetDir{m->dir, m->seq,
+                                                           make_shared<const DirListing>(move(dir_list)),
+                                                           listing_ms, cancelled});
+                continue;
+            }
+
+            if (get_if<SftpThreadCmdPrefetch>(&cmd)) {
+                auto m = get_if<SftpThreadCmdPrefetch>(&cmd);
+                uint64_t budget = m->max_entries;
+                for (auto &dir : m->dirs) {
+                    // Give way as soon as the user asks for something.
+                    if (!cmd_channel->Empty()) {
+                        break;
+                    }
+
+                    bool complete = true;
+                    DirListing dir_list;
+                    try {
+                        dir_list = sftp_connection->GetDir(dir, [&](const DirListing &entries, size_t) {
+                            complete = entries.Count() <= budget && cmd_channel->Empty();
+                            return complete;
+                        });
+                    } catch (DirListFailedPermission) {
+                        continue;  // The user will find out if they go there.
+                    } catch (FileNotFound) {
+                        continue;
+                    } catch (DirListFailed) {
+                        continue;
+                    }
+                    if (!complete || dir_list.Count() > budget) {
+                        break;
+                    }
+
+                    budget -= dir_list.Count();
+                    respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_PREFETCHED,
+                                      SftpThreadResponsePrefetched{dir, make_shared<const DirListing>(move(dir_list))});
+                }
+                continue;
+            }
+
+            if (get_if<SftpThreadCmdListSubdirs>(&cmd)) {
+                auto m = get_if<SftpThreadCmdListSubdirs>(&cmd);
+                DirListingSnapshot dir_list;
+                bool dirs_only = false;
+                try {
+                    optional<DirListing> subdirs;
+                    if (m->bulk) {
+                        subdirs = sftp_connection->GetSubdirsBulk(m->dir);
+                    }
+                    if (subdirs.has_value()) {
+                        dir_list = make_shared<const DirListing>(move(*subdirs));
+                        dirs_only = true;
+                    } else {
+                        // SFTP can't leave the files out, so the tree picks the subdirs out of the whole listing.
+                        dir_list = make_shared<const DirListing>(sftp_connection->GetDir(m->dir));
+                    }
+                } catch (DirListFailedPermission) {
+                    // Shown in the tree as having no subdirs.
+                } catch (FileNotFound) {
+                }
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUBDIRS,
+                                  SftpThreadResponseSubdirs{m->dir, dir_list, dirs_only});
                 continue;
             }
 
@@ -151,16 +282,50 @@ void sftpThreadFunc(
                     continue;
                 }
 
-                bool completed = sftp_connection->DownloadFile(
-                        m->remote_path,
-                        m->local_path,
-                        cancel,
-                        download_progress);
+                if (m->cache && dir_entry.has_value() && m->cache->Get(m->remote_path, *dir_entry, m->local_path)) {
+                    respondToUIThread(
+                            response_dest,
+                            ID_SFTP_THREAD_RESPONSE_DOWNLOAD,
+                            SftpThreadResponseDownload{
+                                    m->local_path, m->remote_path, m->open_in_editor, 0, 0, dir_entry, true,
+                                    m->open_in_editor ? hashFile(m->local_path) : nullopt});
+                    continue;
+                }
+
+                bool completed;
+                if (m->compress) {
+                    completed = sftp_connection->DownloadFileCompressed(
+                            m->remote_path,
+                            m->local_path,
+                            cancel,
+                            download_progress);
+                } else {
+                    completed = sftp_connection->DownloadFile(
+                            m->remote_path,
+                            m->local_path,
+                            cancel,
+                            download_progress);
+                }
+                if (completed && m->cache && dir_entry.has_value()) {
+                    // Only kept if it did not change while downloading, as it would be kept as the wrong version.
+                    auto after = sftp_connection->Stat(m->remote_path);
+                    if (after.has_value() && after->SameVersion(*dir_entry)) {
+                        m->cache->Put(m->remote_path, *dir_entry, m->local_path);
+                    }
+                }
                 if (completed) {
                     respondToUIThread(
                             response_dest,
                             ID_SFTP_THREAD_RESPONSE_DOWNLOAD,
-                            SftpThreadResponseDownload{m->local_path, m->remote_path, m->open_in_editor});
+                            SftpThreadResponseDownload{
+                                    m->local_path,
+                                    m->remote_path,
+                                    m->open_in_editor,
+                                    sftp_connection->last_transfer_wire_bytes_,
+                                    sftp_connection->last_transfer_file_bytes_,
+                                    dir_entry,
+                                    false,
+                                    m->open_in_editor ? hashFile(m->local_path) : nullopt});
                 } else {
                     respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_CANCELLED);
                 }
@@ -169,20 +334,67 @@ void sftpThreadFunc(
 
             if (get_if<SftpThreadCmdUploadOverwrite>(&cmd)) {
                 auto m = get_if<SftpThreadCmdUploadOverwrite>(&cmd);
-                bool completed = sftp_connection->UploadFile(
-                        m->local_path,
-                        m->remote_path,
-                        cancel,
-                        upload_progress);
+
+                // Editors often write a file again without changing it, for example when formatting on save, which
+                // needs no upload.
+                optional<uint64_t> hash;
+                if (m->hash_content) {
+                    hash = hashFile(m->local_path);
+                    if (hash.has_value() && hash == m->remote_hash) {
+                        respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_UPLOAD_UNCHANGED,
+                                          SftpThreadResponseUploadUnchanged{m->remote_path});
+                        continue;
+                    }
+                }
+
+                // Someone else may have changed the file since it was opened, which overwriting would lose. A file
+                // deleted remotely is simply uploaded again.
+                if (m->expected.has_value()) {
+                    auto dir_entry = sftp_connection->Stat(m->remote_path);
+                    if (dir_entry.has_value() && !dir_entry->SameVersion(*m->expected)) {
+                        respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_REMOTE_CHANGED,
+                                          SftpThreadResponseRemoteChanged{m->remote_path, *dir_entry});
+                        continue;
+                    }
+                }
+
+                bool completed;
+                if (m->compress) {
+                    completed = sftp_connection->UploadFileCompressed(
+                            m->local_path,
+                            m->remote_path,
+                            cancel,
+                            upload_progress);
+                } else {
+                    completed = sftp_connection->UploadFile(
+                            m->local_path,
+                            m->remote_path,
+                            cancel,
+                            upload_progress);
+                }
                 if (completed) {
                     respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_UPLOAD,
-                                      SftpThreadResponseUpload{m->remote_path});
+                                      SftpThreadResponseUpload{
+                                              m->remote_path,
+                                              sftp_connection->last_transfer_wire_bytes_,
+                                              sftp_connection->last_transfer_file_bytes_,
+                                              stat_created(m->remote_path),
+                                              hash});
                 } else {
                     respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_CANCELLED);
                 }
                 continue;
             }
 
+            if (get_if<SftpThreadCmdStatOpened>(&cmd)) {
+                auto m = get_if<SftpThreadCmdStatOpened>(&cmd);
+                // Pipelined, so this takes about one round trip however many files are open.
+                auto entries = sftp_connection->Stat(m->remote_paths);
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_STAT_OPENED,
+                                  SftpThreadResponseStatOpened{m->remote_paths, entries});
+                continue;
+            }
+
             if (get_if<SftpThreadCmdUpload>(&cmd)) {
                 auto m = get_if<SftpThreadCmdUpload>(&cmd);
 
@@ -203,14 +415,27 @@ void sftpThreadFunc(
                     continue;
                 }
 
-                bool completed = sftp_connection->UploadFile(
-                        m->local_path,
-                        m->remote_path,
-                        cancel,
-                        upload_progress);
+                bool completed;
+                if (m->compress) {
+                    completed = sftp_connection->UploadFileCompressed(
+                            m->local_path,
+                            m->remote_path,
+                            cancel,
+                            upload_progress);
+                } else {
+                    completed = sftp_connection->UploadFile(
+                            m->local_path,
+                            m->remote_path,
+                            cancel,
+                            upload_progress);
+                }
                 if (completed) {
                     respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_UPLOAD,
-                                      SftpThreadResponseUpload{m->remote_path});
+                                      SftpThreadResponseUpload{
+                                              m->remote_path,
+                                              sftp_connection->last_transfer_wire_bytes_,
+                                              sftp_connection->last_transfer_file_bytes_,
+                                              stat_created(m->remote_path)});
                 } else {
                     respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_CANCELLED);
                 }
@@ -220,28 +445,32 @@ void sftpThreadFunc(
             if (get_if<SftpThreadCmdRename>(&cmd)) {
                 auto m = get_if<SftpThreadCmdRename>(&cmd);
                 sftp_connection->Rename(m->remote_old_path, m->remote_new_path);
-                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS);
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS,
+                                  SftpThreadResponseSuccess{cmd, stat_created(m->remote_new_path)});
                 continue;
             }
 
             if (get_if<SftpThreadCmdDelete>(&cmd)) {
                 auto m = get_if<SftpThreadCmdDelete>(&cmd);
                 sftp_connection->Delete(m->remote_path);
-                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_DELETE_SUCCEEDED);
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_DELETE_SUCCEEDED,
+                                  SftpThreadResponseSuccess{cmd, nullopt});
                 continue;
             }
 
             if (get_if<SftpThreadCmdMkdir>(&cmd)) {
                 auto m = get_if<SftpThreadCmdMkdir>(&cmd);
                 sftp_connection->Mkdir(m->remote_path);
-                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS);
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS,
+                                  SftpThreadResponseSuccess{cmd, stat_created(m->remote_path)});
                 continue;
             }
 
             if (get_if<SftpThreadCmdMkfile>(&cmd)) {
                 auto m = get_if<SftpThreadCmdMkfile>(&cmd);
                 sftp_connection->Mkfile(m->remote_path);
-                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS);
+                respondToUIThread(response_dest, ID_SFTP_THREAD_RESPONSE_SUCCESS,
+                                  SftpThreadResponseSuccess{cmd, stat_created(m->remote_path)});
                 continue;
             }
 
@@ -11,20 +11,26 @@
 #include <wx/wx.h>
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <variant>
 #include <vector>
 
 #include "src/channel.h"
 #include "src/direntry.h"
+#include "src/dirlisting.h"
+#include "src/downloadcache.h"
 #include "src/hostdesc.h"
 #include "src/ids.h"
 
+using std::optional;
 using std::shared_ptr;
 using std::string;
 using std::variant;
 using std::vector;
 
+class SshSession;
+
 struct SftpThreadCmdConnect {
     HostDesc host_desc;
 };
@@ -42,18 +48,62 @@ struct SftpThreadCmdPassword {
 
 struct SftpThreadResponseConnected {
     string home_dir;
+    shared_ptr<SshSession> session;  // For opening transfer sessions on.
 };
 
 struct SftpThreadCmdShutdown {
 };
 
+// Opens a transfer session as SFTP channels on the SSH session of the browsing connection, so without connecting and
+// authenticating again. A server refusing more channels is an ID_SFTP_THREAD_RESPONSE_ERROR_CONNECTION.
+struct SftpThreadCmdConnectPooled {
+    HostDesc host_desc;
+    shared_ptr<SshSession> session;
+    bool sudo = false;
+    wxSecretValue sudo_password;
+};
+
 struct SftpThreadCmdGetDir {
     string dir;
+    uint64_t seq;  // Echoed in the responses, so the UI can tell them apart from those of superseded listings.
+    bool bulk = false;
+};
+
+struct SftpThreadResponseGetDirPartial {
+    string dir;
+    uint64_t seq;
+    DirListingSnapshot new_entries;
 };
 
 struct SftpThreadResponseGetDir {
     string dir;
-    vector<DirEntry> dir_list;
+    uint64_t seq;
+    DirListingSnapshot dir_list;
+    int64_t listing_ms;
+    bool cancelled;
+};
+
+// Lists dirs in the background, in order, until any other command arrives or max_entries entries were listed.
+struct SftpThreadCmdPrefetch {
+    vector<string> dirs;
+    uint64_t max_entries;
+};
+
+struct SftpThreadResponsePrefetched {
+    string dir;
+    DirListingSnapshot dir_list;
+};
+
+// Lists a dir expanded in the dir tree.
+struct SftpThreadCmdListSubdirs {
+    string dir;
+    bool bulk;  // Just the subdirs with find on the remote when it can, rather than the whole listing over SFTP.
+};
+
+struct SftpThreadResponseSubdirs {
+    string dir;
+    DirListingSnapshot dir_list;  // Null if the dir could not be listed.
+    bool dirs_only = false;  // If so, dir_list is not the whole listing of dir.
 };
 
 struct SftpThreadResponseError {
@@ -63,15 +113,32 @@ struct SftpThreadResponseError {
 struct SftpThreadCmdUpload {
     string local_path;
     string remote_path;
+    bool compress = false;
 };
 
 struct SftpThreadCmdUploadOverwrite {
     string local_path;
     string remote_path;
+    bool compress = false;
+    // The remote file as last seen. If set, and the remote file has changed since, it is left alone and
+    // ID_SFTP_THREAD_RESPONSE_REMOTE_CHANGED comes back instead.
+    optional<DirEntry> expected;
+    // If set, the content is hashed first, and if it hashes to remote_hash, nothing is uploaded and
+    // ID_SFTP_THREAD_RESPONSE_UPLOAD_UNCHANGED comes back instead.
+    bool hash_content = false;
+    optional<uint64_t> remote_hash;
 };
 
 struct SftpThreadResponseUpload {
     string remote_path;
+    uint64_t wire_bytes;
+    uint64_t file_bytes;
+    optional<DirEntry> entry;  // The uploaded file as it is now on the server, if it could be looked up.
+    optional<uint64_t> hash;  // Of the content uploaded, if hash_content was set.
+};
+
+struct SftpThreadResponseUploadUnchanged {
+    string remote_path;
 };
 
 struct SftpThreadResponseConfirmOverwrite {
@@ -83,12 +150,34 @@ struct SftpThreadCmdDownload {
     string local_path;
     string remote_path;
     bool open_in_editor;
+    bool compress = false;
+    shared_ptr<DownloadCache> cache;  // If set, the file is taken from here when unchanged, and kept here otherwise.
 };
 
 struct SftpThreadResponseDownload {
     string local_path;
     string remote_path;
     bool open_in_editor;
+    uint64_t wire_bytes;
+    uint64_t file_bytes;
+    optional<DirEntry> entry;  // The remote file as it was when the download started.
+    bool from_cache = false;
+    optional<uint64_t> hash;  // Of the content downloaded, for files opened in the editor.
+};
+
+// Stats the files opened in the editor, all in one go.
+struct SftpThreadCmdStatOpened {
+    vector<string> remote_paths;
+};
+
+struct SftpThreadResponseStatOpened {
+    vector<string> remote_paths;
+    vector<optional<DirEntry>> entries;  // Nullopt for files that could not be stat'ed.
+};
+
+struct SftpThreadResponseRemoteChanged {
+    string remote_path;
+    DirEntry entry;  // The remote file as it is now.
 };
 
 struct SftpThreadResponseDirectoryAlreadyExists {
@@ -144,12 +233,16 @@ struct SftpThreadCmdSudoExit {
 typedef variant<
         SftpThreadCmdShutdown,
         SftpThreadCmdConnect,
+        SftpThreadCmdConnectPooled,
         SftpThreadCmdFingerprintApproved,
         SftpThreadCmdPassword,
         SftpThreadCmdGetDir,
+        SftpThreadCmdPrefetch,
+        SftpThreadCmdListSubdirs,
         SftpThreadCmdDownload,
         SftpThreadCmdUpload,
         SftpThreadCmdUploadOverwrite,
+        SftpThreadCmdStatOpened,
         SftpThreadCmdRename,
         SftpThreadCmdDelete,
         SftpThreadCmdMkdir,
@@ -164,15 +257,23 @@ struct SftpThreadResponseFileError {
     threadFuncVariant cmd;
 };
 
+struct SftpThreadResponseSuccess {
+    threadFuncVariant cmd;
+    optional<DirEntry> entry;  // The created or renamed file or directory, if it could be looked up.
+};
+
 struct SftpThreadResponseDeleteError {
     string remote_path;
     string err;
     threadFuncVariant cmd;
 };
 
+// Runs the commands from cmd_channel on a connection of its own. Responses are wxThreadEvents with the session number
+// as their int, which is 0 for the browsing connection and counts from 1 for transfer sessions.
 void sftpThreadFunc(
         wxEvtHandler *response_dest,
         shared_ptr<Channel<threadFuncVariant>> cmd_channel,
-        shared_ptr<Channel<bool>> cancellation_channel);
+        shared_ptr<Channel<bool>> cancellation_channel,
+        int session);
 
 #endif  // SRC_SFTPTHREAD_H_
@@ -54,6 +54,20 @@ string PrettifySentence(string s) {
     return s;
 }
 
+// Quote a string for safe use as a single argument in a POSIX shell command line on the remote.
+string shellQuote(string s) {
+    string r = "'";
+    for (char c : s) {
+        if (c == '\'') {
+            r += "'\\''";
+        } else {
+            r += c;
+        }
+    }
+    r += "'";
+    return r;
+}
+
 #ifdef __WXMSW__
 
 wstring localPathUnicode(string local_path) {
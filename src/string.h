@@ -14,6 +14,8 @@ string encodeBase64(const unsigned char *input, int n);
 
 string PrettifySentence(string s);
 
+string shellQuote(string s);
+
 #ifdef __WXMSW__
 
 wstring localPathUnicode(string local_path);
@@ -0,0 +1,186 @@
+// Copyright 2023 Allan Riordan Boll
+
+#include "src/transferpool.h"
+
+#ifdef __WXMSW__
+#include <winsock2.h>  // Several header files include windows.h, but winsock2.h needs to come first.
+#endif
+
+#include <wx/secretstore.h>
+#include <wx/wx.h>
+
+#include <chrono>  // NOLINT
+#include <future>  // NOLINT
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/channel.h"
+#include "src/hostdesc.h"
+#include "src/sftpthread.h"
+
+using std::async;
+using std::future_status;
+using std::launch;
+using std::make_unique;
+using std::move;
+using std::vector;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+TransferPool::TransferPool(wxEvtHandler *response_dest, HostDesc host_desc, size_t max_sessions) {
+    this->response_dest_ = response_dest;
+    this->max_sessions_ = max_sessions;
+    this->connect_.host_desc = host_desc;
+}
+
+TransferPool::~TransferPool() {
+    for (auto &s : this->sessions_) {
+        if (!s->thread) {
+            continue;
+        }
+        s->cmd_channel->Put(SftpThreadCmdShutdown{});
+        s->cancellation_channel->Put(true);
+        this->stopped_.push_back(move(s->thread));
+    }
+
+    // Waited for up to 2 seconds in all, like the browsing connection is, so that a transfer being cancelled doesn't
+    // respond to a frame that is gone. Not waited for any longer, as closing would seem to hang.
+    auto deadline = steady_clock::now() + seconds(2);
+    for (auto &thread : this->stopped_) {
+        if (thread->wait_until(deadline) != future_status::ready) {
+            thread.release();
+        }
+    }
+}
+
+bool TransferPool::Available() const {
+    return this->connected_ && !this->unavailable_ && this->max_sessions_ > 0;
+}
+
+void TransferPool::SetSession(shared_ptr<SshSession> session) {
+    this->connect_.session = session;
+    this->connected_ = true;
+    this->unavailable_ = false;  // Worth trying again on the new session.
+    this->Reopen();
+}
+
+void TransferPool::SetSudo(bool sudo, wxSecretValue sudo_password) {
+    if (sudo == this->connect_.sudo) {
+        return;
+    }
+    this->connect_.sudo = sudo;
+    this->connect_.sudo_password = sudo_password;
+    this->Reopen();
+}
+
+void TransferPool::Reopen() {
+    for (auto &s : this->sessions_) {
+        if (s->state == SESSION_IDLE) {
+            s->state = SESSION_CLOSED;
+        } else if (s->state != SESSION_CLOSED) {
+            s->stale = true;
+        }
+    }
+}
+
+void TransferPool::Put(threadFuncVariant cmd) {
+    this->queued_.push_back(cmd);
+    this->Dispatch();
+}
+
+void TransferPool::Dispatch() {
+    size_t connecting = 0;
+    for (auto &s : this->sessions_) {
+        if (this->queued_.empty()) {
+            return;
+        }
+        if (s->state == SESSION_IDLE) {
+            s->cmd_channel->Put(this->queued_.front());
+            this->queued_.pop_front();
+            s->state = SESSION_BUSY;
+        } else if (s->state == SESSION_CONNECTING) {
+            connecting++;
+        }
+    }
+
+    // One session opening for each transfer left, reusing closed ones first.
+    for (size_t i = 0 ; i < this->sessions_.size() || i < this->max_sessions_ ; ++i) {
+        if (connecting >= this->queued_.size()) {
+            return;
+        }
+        if (i == this->sessions_.size()) {
+            this->sessions_.push_back(make_unique<Session>());
+        }
+        auto &s = this->sessions_[i];
+        if (s->state != SESSION_CLOSED) {
+            continue;
+        }
+        if (!s->thread) {
+            s->thread = make_unique<future<void>>(async(
+                    launch::async,
+                    sftpThreadFunc,
+                    this->response_dest_,
+                    s->cmd_channel,
+                    s->cancellation_channel,
+                    i + 1));
+        }
+        s->cmd_channel->Put(this->connect_);
+        s->state = SESSION_CONNECTING;
+        s->stale = false;
+        connecting++;
+    }
+}
+
+void TransferPool::Connected(int session) {
+    auto &s = this->sessions_[session - 1];
+    s->state = s->stale ? SESSION_CLOSED : SESSION_IDLE;
+    this->Dispatch();
+}
+
+void TransferPool::Done(int session) {
+    auto &s = this->sessions_[session - 1];
+    s->state = s->stale ? SESSION_CLOSED : SESSION_IDLE;
+    this->Dispatch();
+}
+
+vector<threadFuncVariant> TransferPool::Failed(int session) {
+    auto &s = this->sessions_[session - 1];
+    bool opening = s->state == SESSION_CONNECTING;
+    s->state = SESSION_CLOSED;
+    if (!opening) {
+        this->Dispatch();  // Opens it again if there is more to do, as the connection may just have dropped.
+        return vector<threadFuncVariant>();
+    }
+
+    // Its thread has no connection to keep alive, so it is shut down, and a new one started if the session is opened
+    // again.
+    s->cmd_channel->Put(SftpThreadCmdShutdown{});
+    this->stopped_.push_back(move(s->thread));
+    s = make_unique<Session>();
+
+    // Probably the server doesn't allow more channels on a session.
+    this->unavailable_ = true;
+    vector<threadFuncVariant> r(this->queued_.begin(), this->queued_.end());
+    this->queued_.clear();
+    return r;
+}
+
+void TransferPool::Cancel() {
+    this->queued_.clear();
+    for (auto &s : this->sessions_) {
+        if (s->state == SESSION_BUSY) {
+            s->cancellation_channel->Put(true);
+        }
+    }
+}
+
+size_t TransferPool::Pending() const {
+    size_t n = this->queued_.size();
+    for (auto &s : this->sessions_) {
+        if (s->state == SESSION_BUSY) {
+            n++;
+        }
+    }
+    return n;
+}
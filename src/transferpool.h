@@ -0,0 +1,107 @@
+// Copyright 2023 Allan Riordan Boll
+
+#ifndef SRC_TRANSFERPOOL_H_
+#define SRC_TRANSFERPOOL_H_
+
+#ifdef __WXMSW__
+#include <winsock2.h>  // Several header files include windows.h, but winsock2.h needs to come first.
+#endif
+
+#include <wx/secretstore.h>
+#include <wx/wx.h>
+
+#include <deque>
+#include <future>  // NOLINT
+#include <memory>
+#include <vector>
+
+#include "src/channel.h"
+#include "src/hostdesc.h"
+#include "src/sftpthread.h"
+
+using std::deque;
+using std::future;
+using std::make_shared;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+// Extra SFTP sessions for the uploads and downloads the user starts, so that browsing isn't held up while they run.
+// They are channels on the SSH session of the browsing connection, rather than connections of their own, as each of
+// those would cost a handshake and authentication, and some hosts limit how many a user may have. Each session is a
+// sftpThreadFunc of its own, which tags its responses with the session number, counting from 1. Sessions are only
+// opened when a transfer finds none idle, up to max_sessions, and are sudo'ed like the browsing connection is.
+class TransferPool {
+private:
+    enum SessionState {
+        SESSION_CLOSED,
+        SESSION_CONNECTING,
+        SESSION_IDLE,
+        SESSION_BUSY,
+    };
+
+    struct Session {
+        shared_ptr<Channel<threadFuncVariant>> cmd_channel = make_shared<Channel<threadFuncVariant>>();
+        shared_ptr<Channel<bool>> cancellation_channel = make_shared<Channel<bool>>();
+        unique_ptr<future<void>> thread;
+        SessionState state = SESSION_CLOSED;
+        bool stale = false;  // Opened on an earlier SSH session, or sudo'ed differently, so to be opened again.
+    };
+
+    wxEvtHandler *response_dest_;
+    size_t max_sessions_;
+    SftpThreadCmdConnectPooled connect_;
+    bool connected_ = false;
+    bool unavailable_ = false;
+    vector<unique_ptr<Session>> sessions_;
+    vector<unique_ptr<future<void>>> stopped_;  // Threads of sessions that failed to open, shut down.
+    deque<threadFuncVariant> queued_;
+
+    // Hands queued transfers to idle sessions, and opens more sessions for the rest.
+    void Dispatch();
+
+    // Has the sessions opened again before their next transfer, after connect_ changed.
+    void Reopen();
+
+public:
+    TransferPool(wxEvtHandler *response_dest, HostDesc host_desc, size_t max_sessions);
+
+    ~TransferPool();
+
+    TransferPool(const TransferPool &) = delete;
+
+    TransferPool &operator=(const TransferPool &) = delete;
+
+    // False until the browsing connection is authenticated, if no sessions are allowed, or if opening one failed. The
+    // browsing connection runs the transfers then.
+    bool Available() const;
+
+    // The SSH session of the browsing connection, each time it is connected. Sessions on an earlier one are opened
+    // again on this one before their next transfer.
+    void SetSession(shared_ptr<SshSession> session);
+
+    // Sessions are reconnected as root, or not, before their next transfer.
+    void SetSudo(bool sudo, wxSecretValue sudo_password);
+
+    // Runs cmd on an idle session, or on the first to become idle.
+    void Put(threadFuncVariant cmd);
+
+    // For ID_SFTP_THREAD_RESPONSE_POOL_CONNECTED.
+    void Connected(int session);
+
+    // For the response that ends a transfer.
+    void Done(int session);
+
+    // For ID_SFTP_THREAD_RESPONSE_ERROR_CONNECTION, which fails the transfer the session was running. If the session
+    // could not even be opened, the pool becomes unavailable until the next SetSession, and the queued transfers are
+    // returned to be run on the browsing connection instead.
+    vector<threadFuncVariant> Failed(int session);
+
+    // Cancels the running transfers, and drops the queued ones.
+    void Cancel();
+
+    // Transfers running or queued.
+    size_t Pending() const;
+};
+
+#endif  // SRC_TRANSFERPOOL_H_